@@ -0,0 +1,438 @@
+#pragma once
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "png_text_chunk.hpp"
+#include "thread_pool.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Define PNG_TEXT_CHUNK_USE_IO_URING on Linux to submit reads through io_uring. The ring is
+// driven with raw syscalls, so liburing is not required.
+#ifdef PNG_TEXT_CHUNK_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+namespace png_text_chunk {
+using AsyncCallback = std::function<void(const std::string& path, std::exception_ptr error,
+										 std::unordered_map<std::string, std::string> texts)>;
+
+struct AsyncOptions {
+	std::size_t queue_depth = 128;	// files in flight at once
+	std::size_t read_size = 64 * 1024;
+	bool verify_crc = true;	 // of text chunks
+	std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE;
+};
+
+namespace async_detail {
+// Text chunk extraction driven by externally issued reads: the owner reads
+// [read_offset(), read_offset() + read_length()) into read_buffer() and passes the byte count
+// to consume() until done(). Non-text chunks that do not fit in a read are skipped unread.
+class TextChunkScanner {
+   public:
+	TextChunkScanner(std::uint64_t file_size, const AsyncOptions& options)
+		: file_size_(file_size), options_(options) {
+		if (file_size_ < 8) {
+			throw std::runtime_error("png signature not found");
+		}
+		request(std::max<std::uint64_t>(8, options_.read_size));
+	}
+
+	bool done() const { return done_; }
+	std::uint64_t read_offset() const { return start_ + filled_; }
+	std::size_t read_length() const { return buffer_.size() - filled_; }
+	unsigned char* read_buffer() { return buffer_.data() + filled_; }
+	std::unordered_map<std::string, std::string>& texts() { return texts_; }
+
+	void consume(std::size_t n) {
+		if (n == 0) {
+			throw std::runtime_error("chunk is truncated at offset " + std::to_string(start_));
+		}
+		filled_ += n;
+		if (filled_ < buffer_.size()) {
+			return;
+		}
+
+		std::size_t pos = 0;
+		if (start_ == 0) {
+			if (!is_valid_png(buffer_.data(), buffer_.size())) {
+				throw std::runtime_error("png signature not found");
+			}
+			pos = 8;
+		}
+		std::uint64_t needed = 0;
+		while (true) {
+			auto offset = start_ + pos;
+			if (offset >= file_size_) {
+				done_ = true;
+				return;
+			}
+			if (file_size_ - offset < 8) {
+				throw std::runtime_error("chunk is truncated at offset " + std::to_string(offset));
+			}
+			if (pos + 8 > buffer_.size()) {
+				break;
+			}
+			const auto* p = buffer_.data() + pos;
+			std::uint32_t length = swap_endian(p);
+			std::uint32_t type = swap_endian(p + 4);
+			if (file_size_ - offset < 12ull + length) {
+				throw std::runtime_error("chunk is truncated at offset " + std::to_string(offset));
+			}
+			if (type == tag::tEXt || type == tag::iTXt || type == tag::zTXt) {
+				if (buffer_.size() - pos < 12ull + length) {
+					needed = 12ull + length;
+					break;
+				}
+				ChunkView chunk{type, p + 8, length, swap_endian(p + 8 + length),
+								static_cast<std::size_t>(offset)};
+				if (options_.verify_crc) {
+					check_crc(chunk);
+				}
+				auto [key, value] = decode_text_chunk(chunk, options_.max_text_size);
+				texts_[std::move(key)] = std::move(value);
+			} else if (type == tag::IEND) {
+				done_ = true;
+				return;
+			}
+			pos += 12ull + length;
+		}
+		// after skipping past the buffer the next chunk is usually another large IDAT, so only
+		// its header is worth reading
+		auto read_size = pos > buffer_.size() ? 4096 : options_.read_size;
+		start_ += pos;
+		request(std::max<std::uint64_t>(needed, read_size));
+	}
+
+   private:
+	void request(std::uint64_t length) {
+		filled_ = 0;
+		buffer_.resize(static_cast<std::size_t>(std::min(length, file_size_ - start_)));
+		if (buffer_.empty()) {
+			done_ = true;
+		}
+	}
+
+	std::uint64_t file_size_;
+	const AsyncOptions& options_;
+	std::uint64_t start_ = 0;  // file offset of buffer_[0]
+	std::size_t filled_ = 0;
+	std::vector<unsigned char> buffer_;
+	std::unordered_map<std::string, std::string> texts_;
+	bool done_ = false;
+};
+
+#ifndef _WIN32
+struct FileDescriptor {
+	int fd;
+	explicit FileDescriptor(const std::string& path) : fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {
+		if (fd < 0) {
+			throw std::runtime_error("cannot open a file");
+		}
+	}
+	~FileDescriptor() { ::close(fd); }
+	FileDescriptor(const FileDescriptor&) = delete;
+	FileDescriptor& operator=(const FileDescriptor&) = delete;
+
+	std::uint64_t size() const {
+		struct stat st {};
+		if (::fstat(fd, &st) != 0) {
+			throw std::runtime_error("cannot read a file");
+		}
+		return static_cast<std::uint64_t>(st.st_size);
+	}
+};
+#endif
+
+inline std::unordered_map<std::string, std::string> extract_with_pread(const std::string& path,
+																	   const AsyncOptions& options) {
+#ifndef _WIN32
+	FileDescriptor file(path);
+	TextChunkScanner scanner(file.size(), options);
+	while (!scanner.done()) {
+		ssize_t n = ::pread(file.fd, scanner.read_buffer(), scanner.read_length(),
+							static_cast<off_t>(scanner.read_offset()));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			throw std::runtime_error("cannot read a file");
+		}
+		scanner.consume(static_cast<std::size_t>(n));
+	}
+	return std::move(scanner.texts());
+#else
+	return extract_text_chunks(path);
+#endif
+}
+
+#ifdef PNG_TEXT_CHUNK_USE_IO_URING
+// Minimal io_uring with one submission per read. Throws if the kernel lacks io_uring or
+// IORING_OP_READ (Linux < 5.6), so callers can fall back.
+class Ring {
+   public:
+	explicit Ring(unsigned entries) {
+		io_uring_params params{};
+		fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+		if (fd_ < 0) {
+			throw std::runtime_error("io_uring is not available");
+		}
+		// IORING_FEAT_RW_CUR_POS shipped together with IORING_OP_READ
+		if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+			::close(fd_);
+			throw std::runtime_error("io_uring is too old");
+		}
+		entries_ = params.sq_entries;
+		sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		single_mmap_ = params.features & IORING_FEAT_SINGLE_MMAP;
+		if (single_mmap_) {
+			sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+		}
+		sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+		try {
+			sq_ = map(sq_size_, IORING_OFF_SQ_RING);
+			cq_ = single_mmap_ ? sq_ : map(cq_size_, IORING_OFF_CQ_RING);
+			sqes_ = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+		} catch (...) {
+			unmap();
+			throw;
+		}
+
+		auto sq = static_cast<char*>(sq_);
+		sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		auto cq = static_cast<char*>(cq_);
+		cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+	}
+
+	~Ring() { unmap(); }
+
+	Ring(const Ring&) = delete;
+	Ring& operator=(const Ring&) = delete;
+
+	unsigned entries() const { return entries_; }
+
+	// Queues a read; the caller keeps at most entries() reads in flight.
+	void read(int fd, void* buffer, std::size_t length, std::uint64_t offset,
+			  std::uint64_t user_data) {
+		unsigned tail = *sq_tail_;
+		unsigned index = tail & sq_mask_;
+		auto& sqe = sqes_[index];
+		sqe = io_uring_sqe{};
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = fd;
+		sqe.addr = reinterpret_cast<std::uint64_t>(buffer);
+		sqe.len = static_cast<unsigned>(std::min<std::size_t>(length, 1u << 30));
+		sqe.off = offset;
+		sqe.user_data = user_data;
+		sq_array_[index] = index;
+		__atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+		pending_++;
+	}
+
+	// Submits queued reads and waits for at least one completion, then passes each completion
+	// as (user_data, result) to `f`.
+	template <class F>
+	void wait(F&& f) {
+		while (::syscall(__NR_io_uring_enter, fd_, pending_, 1, IORING_ENTER_GETEVENTS, nullptr,
+						 0) < 0) {
+			if (errno != EINTR) {
+				throw std::runtime_error("io_uring_enter failed");
+			}
+		}
+		pending_ = 0;
+		unsigned head = *cq_head_;
+		unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			auto& cqe = cqes_[head & cq_mask_];
+			auto user_data = cqe.user_data;
+			auto res = cqe.res;
+			__atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+			f(user_data, res);
+		}
+	}
+
+   private:
+	void unmap() {
+		if (sqes_) {
+			::munmap(sqes_, sqes_size_);
+		}
+		if (cq_ && !single_mmap_) {
+			::munmap(cq_, cq_size_);
+		}
+		if (sq_) {
+			::munmap(sq_, sq_size_);
+		}
+		::close(fd_);
+	}
+
+	void* map(std::size_t size, off_t offset) {
+		void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+						 offset);
+		if (p == MAP_FAILED) {
+			throw std::runtime_error("cannot map io_uring");
+		}
+		return p;
+	}
+
+	int fd_ = -1;
+	unsigned entries_ = 0;
+	unsigned pending_ = 0;
+	bool single_mmap_ = false;
+	std::size_t sq_size_ = 0, cq_size_ = 0, sqes_size_ = 0;
+	void* sq_ = nullptr;
+	void* cq_ = nullptr;
+	io_uring_sqe* sqes_ = nullptr;
+	unsigned *sq_tail_, *sq_array_, sq_mask_;
+	unsigned *cq_head_, *cq_tail_, cq_mask_;
+	io_uring_cqe* cqes_;
+};
+
+// Keeps up to queue_depth files in flight on one ring, each with one outstanding read.
+inline void extract_with_io_uring(Ring& ring, const std::vector<std::string>& paths,
+								  const AsyncCallback& callback, const AsyncOptions& options) {
+	struct InFlight {
+		std::size_t index;
+		FileDescriptor file;
+		TextChunkScanner scanner;
+		InFlight(std::size_t i, const std::string& path, const AsyncOptions& options)
+			: index(i), file(path), scanner(file.size(), options) {}
+	};
+	std::vector<std::unique_ptr<InFlight>> slots(std::min<std::size_t>(
+		std::max<std::size_t>(options.queue_depth, 1), ring.entries()));
+	std::vector<std::size_t> free_slots;
+	for (std::size_t i = slots.size(); i-- > 0;) {
+		free_slots.push_back(i);
+	}
+	std::exception_ptr callback_error;
+	auto finish = [&](std::size_t index, std::exception_ptr error,
+					  std::unordered_map<std::string, std::string> texts) {
+		try {
+			callback(paths[index], error, std::move(texts));
+		} catch (...) {
+			if (!callback_error) {
+				callback_error = std::current_exception();
+			}
+		}
+	};
+	// issues the next read of slot `s`, or completes and frees it
+	auto advance = [&](std::size_t s) {
+		auto& scanner = slots[s]->scanner;
+		if (!scanner.done()) {
+			ring.read(slots[s]->file.fd, scanner.read_buffer(), scanner.read_length(),
+					  scanner.read_offset(), s);
+			return;
+		}
+		auto index = slots[s]->index;
+		auto texts = std::move(scanner.texts());
+		slots[s].reset();
+		free_slots.push_back(s);
+		finish(index, nullptr, std::move(texts));
+	};
+
+	std::size_t next = 0;
+	while (true) {
+		while (!free_slots.empty() && next < paths.size()) {
+			auto s = free_slots.back();
+			auto index = next++;
+			try {
+				slots[s] = std::make_unique<InFlight>(index, paths[index], options);
+			} catch (...) {
+				finish(index, std::current_exception(), {});
+				continue;
+			}
+			free_slots.pop_back();
+			advance(s);
+		}
+		if (free_slots.size() == slots.size()) {
+			break;
+		}
+		ring.wait([&](std::uint64_t s, int res) {
+			try {
+				if (res < 0) {
+					throw std::runtime_error("cannot read a file");
+				}
+				slots[s]->scanner.consume(static_cast<std::size_t>(res));
+			} catch (...) {
+				auto index = slots[s]->index;
+				slots[s].reset();
+				free_slots.push_back(s);
+				finish(index, std::current_exception(), {});
+				return;
+			}
+			advance(s);
+		});
+	}
+	if (callback_error) {
+		std::rethrow_exception(callback_error);
+	}
+}
+#endif
+
+inline void extract_with_pool(const std::vector<std::string>& paths,
+							  const AsyncCallback& callback, const AsyncOptions& options) {
+	ThreadPool pool(std::min<std::size_t>(std::max<std::size_t>(options.queue_depth, 1), 32));
+	std::mutex callback_mutex;
+	for (auto& path : paths) {
+		pool.submit([&] {
+			std::exception_ptr error;
+			std::unordered_map<std::string, std::string> texts;
+			try {
+				texts = extract_with_pread(path, options);
+			} catch (...) {
+				error = std::current_exception();
+			}
+			std::lock_guard<std::mutex> lock(callback_mutex);
+			callback(path, error, std::move(texts));
+		});
+	}
+	pool.wait();
+}
+}  // namespace async_detail
+
+// Extracts the text chunks of every file in `paths` in the background, keeping up to
+// options.queue_depth files in flight: through io_uring when built with it and supported by
+// the kernel, otherwise with pread on a thread pool. `callback` runs once per file, in
+// completion order and never concurrently, with either the texts or the error of that file.
+// The returned future becomes ready after the last callback and rethrows the first exception
+// a callback threw.
+inline std::future<void> extract_text_chunks_async(std::vector<std::string> paths,
+												   AsyncCallback callback,
+												   AsyncOptions options = {}) {
+	return std::async(std::launch::async, [paths = std::move(paths),
+										   callback = std::move(callback), options] {
+#ifdef PNG_TEXT_CHUNK_USE_IO_URING
+		std::unique_ptr<async_detail::Ring> ring;
+		try {
+			ring = std::make_unique<async_detail::Ring>(static_cast<unsigned>(
+				std::min<std::size_t>(std::max<std::size_t>(options.queue_depth, 1), 4096)));
+		} catch (const std::runtime_error&) {
+		}
+		if (ring) {
+			async_detail::extract_with_io_uring(*ring, paths, callback, options);
+			return;
+		}
+#endif
+		async_detail::extract_with_pool(paths, callback, options);
+	});
+}
+}  // namespace png_text_chunk
@@ -0,0 +1,622 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <random>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#define CRCPP_USE_CPP11
+#include "async_extract.hpp"
+#include "CRC.h"
+#include "chunk_index.hpp"
+#include "corpus.hpp"
+#include "metadata_cache.hpp"
+#include "parallel_extract.hpp"
+#include "png_text_chunk.hpp"
+#include "stream_parser.hpp"
+
+// every allocation made through operator new, for allocations per op
+static std::atomic<std::size_t> allocation_count{0};
+
+void* operator new(std::size_t size) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size == 0 ? 1 : size)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+// out of line, so GCC does not pair the inlined free() with operator new and warn
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void deallocate(void* p) noexcept {
+	std::free(p);
+}
+void operator delete(void* p) noexcept { deallocate(p); }
+void operator delete(void* p, std::size_t) noexcept { deallocate(p); }
+
+template <class F>
+double measure_mb_per_sec(std::size_t bytes_per_iter, int iterations, F&& f) {
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		f();
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return static_cast<double>(bytes_per_iter) * iterations / elapsed.count() / (1024 * 1024);
+}
+
+void bench_crc(std::size_t size, int iterations) {
+	std::vector<unsigned char> data(size);
+	std::mt19937 rng(0);
+	for (auto& c : data) {
+		c = static_cast<unsigned char>(rng());
+	}
+
+	using namespace png_text_chunk::crc32_detail;
+	const auto expected = CRC::Calculate(data.data(), data.size(), CRC::CRC_32());
+	for (auto kernel : {Kernel::slice8, Kernel::pclmul}) {
+		if (kernel == Kernel::pclmul && selected_kernel() != Kernel::pclmul) {
+			continue;
+		}
+		if (~update(~0u, data.data(), data.size(), kernel) != expected) {
+			throw std::runtime_error("crc32 kernel mismatch");
+		}
+	}
+
+	static const CRC::Table<std::uint32_t, 32> crcpp_table(CRC::CRC_32());
+	volatile std::uint32_t sink = 0;
+	auto bitwise = measure_mb_per_sec(size, iterations, [&] {
+		sink = CRC::Calculate(data.data(), data.size(), CRC::CRC_32());
+	});
+	auto table = measure_mb_per_sec(size, iterations, [&] {
+		sink = CRC::Calculate(data.data(), data.size(), crcpp_table);
+	});
+	auto slice8 = measure_mb_per_sec(size, iterations, [&] {
+		sink = ~update(~0u, data.data(), data.size(), Kernel::slice8);
+	});
+	auto dispatched = measure_mb_per_sec(size, iterations, [&] {
+		sink = png_text_chunk::calculate_crc(data.data(), data.size());
+	});
+	std::printf(
+		"crc32 %10zu bytes: bitwise %8.1f MB/s, table %8.1f MB/s, slice8 %8.1f MB/s, "
+		"dispatched %8.1f MB/s\n",
+		size, bitwise, table, slice8, dispatched);
+}
+
+// signature, IHDR, one tEXt, IDATs of `idat_sizes` bytes, IEND
+std::vector<char> make_png(const std::vector<std::size_t>& idat_sizes) {
+	std::vector<char> png = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+	char ihdr[13] = {};
+	png_text_chunk::corpus::append_chunk(png, "IHDR", ihdr, sizeof(ihdr));
+	auto text = png_text_chunk::generate_text_chunk<char>("Software", "bench");
+	png.insert(png.end(), text.begin(), text.end());
+	std::vector<char> idat(idat_sizes.empty() ? 0
+											  : *std::max_element(idat_sizes.begin(),
+																  idat_sizes.end()));
+	std::mt19937 rng(0);
+	for (auto& c : idat) {
+		c = static_cast<char>(rng());
+	}
+	for (auto size : idat_sizes) {
+		png_text_chunk::corpus::append_chunk(png, "IDAT", idat.data(), size);
+	}
+	png_text_chunk::corpus::append_chunk(png, "IEND", nullptr, 0);
+	return png;
+}
+
+std::vector<char> make_png(std::size_t idat_size, std::size_t idat_count) {
+	return make_png(std::vector<std::size_t>(idat_count, idat_size));
+}
+
+void write_file(const std::string& filename, const std::vector<char>& data) {
+	std::ofstream ofs(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	ofs.write(data.data(), data.size());
+}
+
+void bench_verify(std::size_t idat_size, std::size_t idat_count, int iterations) {
+	constexpr auto filename = "bench_verify.png";
+	auto png = make_png(idat_size, idat_count);
+	write_file(filename, png);
+
+	std::vector<char> buffer(1 << 16);
+	auto read_only = measure_mb_per_sec(png.size(), iterations, [&] {
+		std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+		while (ifs.read(buffer.data(), buffer.size())) {
+		}
+	});
+	auto extract = measure_mb_per_sec(png.size(), iterations, [&] {
+		png_text_chunk::extract_text_chunks(std::string(filename));
+	});
+	auto extract_verify = measure_mb_per_sec(png.size(), iterations, [&] {
+		png_text_chunk::extract_text_chunks(std::string(filename), true, true);
+	});
+	auto verify_vector = measure_mb_per_sec(png.size(), iterations, [&] {
+		if (png_text_chunk::find_corrupt_chunk(png)) {
+			throw std::runtime_error("unexpected corrupt chunk");
+		}
+	});
+	std::printf(
+		"verify %10zu bytes (%zu IDATs): file read %8.1f MB/s, extract %8.1f MB/s, "
+		"extract+verify_all %8.1f MB/s, verify in memory %8.1f MB/s\n",
+		png.size(), idat_count, read_only, extract, extract_verify, verify_vector);
+	std::remove(filename);
+}
+
+void bench_insert(std::size_t idat_size, std::size_t tag_count, int iterations) {
+	auto png = make_png(idat_size, 1);
+	std::vector<png_text_chunk::KV> kvs;
+	for (std::size_t i = 0; i < tag_count; i++) {
+		kvs.push_back({"key" + std::to_string(i), std::string(64, 'v')});
+	}
+
+	auto per_chunk = measure_mb_per_sec(png.size(), iterations, [&] {
+		auto img = png;
+		auto begin = img.cbegin() + 33;	 // signature + IHDR
+		for (auto& [k, v] : kvs) {
+			png_text_chunk::insert_text_chunk(img, begin, k, v);
+		}
+	});
+	auto in_place = measure_mb_per_sec(png.size(), iterations, [&] {
+		auto img = png;
+		png_text_chunk::insert_text_chunks_in_place(img, kvs);
+	});
+	auto single_pass = measure_mb_per_sec(png.size(), iterations, [&] {
+		png_text_chunk::insert_text_chunks<char>(
+			reinterpret_cast<const unsigned char*>(png.data()), png.size(), kvs);
+	});
+	std::printf(
+		"insert %zu tags into %10zu bytes: per-chunk insert %8.1f MB/s, in place %8.1f MB/s, "
+		"single pass %8.1f MB/s\n",
+		tag_count, png.size(), per_chunk, in_place, single_pass);
+}
+
+void bench_compression(std::size_t text_size, int iterations) {
+	auto png = make_png(1024 * 1024, 1);
+	std::string json;
+	std::mt19937 rng(0);
+	while (json.size() < text_size) {
+		json += "{\"id\":" + std::to_string(rng() % 100000) + ",\"tool\":\"renderer\",\"ok\":true},";
+	}
+	std::vector<png_text_chunk::KV> kvs = {{"provenance", json}};
+
+	std::printf("compress %zu bytes of JSON:", json.size());
+	for (int level : {0, 1, 6, 9}) {
+		png_text_chunk::Compression compression;
+		if (level > 0) {
+			compression = {0, level};
+		}
+		std::size_t out_size = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			out_size = png_text_chunk::insert_text_chunks<char>(
+						   reinterpret_cast<const unsigned char*>(png.data()), png.size(), kvs,
+						   false, true, compression)
+						   .size();
+		}
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		std::printf(" level %d: +%zu bytes %.0f us/insert;", level, out_size - png.size(),
+					elapsed.count() / iterations);
+	}
+	std::printf("\n");
+}
+
+void bench_parallel_inflate(std::size_t text_count, std::size_t text_size, int iterations) {
+	auto png = make_png(1024, 1);
+	std::vector<png_text_chunk::KV> kvs;
+	std::mt19937 rng(0);
+	for (std::size_t i = 0; i < text_count; i++) {
+		std::string text;
+		while (text.size() < text_size) {
+			text += "<rdf:li>" + std::to_string(rng() % 1000) + "</rdf:li>";
+		}
+		kvs.push_back({"xmp" + std::to_string(i), text});
+	}
+	auto img = png_text_chunk::insert_text_chunks(std::move(png), kvs, true, true, {0, 6});
+	auto data = reinterpret_cast<const unsigned char*>(img.data());
+
+	png_text_chunk::ThreadPool pool;
+	auto serial = measure_mb_per_sec(text_count * text_size, iterations, [&] {
+		png_text_chunk::extract_text_chunks(data, img.size());
+	});
+	auto parallel = measure_mb_per_sec(text_count * text_size, iterations, [&] {
+		png_text_chunk::extract_text_chunks_parallel(data, img.size(), pool);
+	});
+	std::printf(
+		"inflate %zu x %zu bytes: serial %8.1f MB/s, parallel (%zu threads) %8.1f MB/s\n",
+		text_count, text_size, serial, pool.size(), parallel);
+}
+
+void bench_selected(std::size_t text_count, std::size_t text_size, int iterations) {
+	std::vector<png_text_chunk::KV> kvs;
+	for (std::size_t i = 0; i < text_count; i++) {
+		kvs.push_back({"blob" + std::to_string(i), std::string(text_size, 'x')});
+	}
+	kvs.push_back({"Software", "bench"});
+	auto img = png_text_chunk::insert_text_chunks(make_png(1024, 1), kvs);
+	auto data = reinterpret_cast<const unsigned char*>(img.data());
+
+	auto all = measure_mb_per_sec(img.size(), iterations,
+								  [&] { png_text_chunk::extract_text_chunks(data, img.size()); });
+	auto selected = measure_mb_per_sec(img.size(), iterations, [&] {
+		png_text_chunk::extract_selected_text_chunks(data, img.size(), {"Software"});
+	});
+	std::printf("lookup 1 key among %zu x %zu bytes: all %8.1f MB/s, selected %8.1f MB/s\n",
+				text_count, text_size, all, selected);
+}
+
+// Allocations per call and throughput of extraction into heap strings and into an arena that
+// is reset for each file.
+void bench_arena(std::size_t text_count, std::size_t text_size, int iterations) {
+	std::vector<png_text_chunk::KV> kvs;
+	for (std::size_t i = 0; i < text_count; i++) {
+		kvs.push_back({"key" + std::to_string(i), std::string(text_size, 'x')});
+	}
+	auto img = png_text_chunk::insert_text_chunks(make_png(64 * 1024, 4), kvs);
+	auto data = reinterpret_cast<const unsigned char*>(img.data());
+
+	auto run = [&](auto&& extract) {
+		auto allocations = allocation_count.load();
+		auto mb_per_sec = measure_mb_per_sec(img.size(), iterations, extract);
+		return std::make_pair(
+			mb_per_sec, static_cast<double>(allocation_count.load() - allocations) / iterations);
+	};
+	auto heap = run([&] { png_text_chunk::extract_text_chunks(data, img.size()); });
+	std::vector<std::byte> buffer(1 << 20);
+	auto arena = run([&] {
+		std::pmr::monotonic_buffer_resource resource(buffer.data(), buffer.size());
+		png_text_chunk::extract_text_chunks(data, img.size(), &resource);
+	});
+	std::printf("extract %zu x %zu bytes texts: heap %8.1f MB/s %6.1f allocs, "
+				"arena %8.1f MB/s %6.1f allocs\n",
+				text_count, text_size, heap.first, heap.second, arena.first, arena.second);
+}
+
+void bench_index(std::size_t idat_size, std::size_t idat_count, int iterations) {
+	auto img = png_text_chunk::insert_text_chunks(make_png(idat_size, idat_count),
+												  {{"Software", "bench"}});
+	const std::string filename = "bench_index.png";
+	write_file(filename, img);
+
+	auto walk = measure_mb_per_sec(img.size(), iterations, [&] {
+		png_text_chunk::extract_text_chunks(filename, png_text_chunk::ExtractMode::full);
+	});
+	png_text_chunk::ChunkIndexCache cache(16);
+	auto indexed = measure_mb_per_sec(img.size(), iterations, [&] {
+		cache.get(filename)->lookup(filename, "Software");
+	});
+	std::printf("lookup in %zu x %zu bytes IDAT: walk %8.1f MB/s, index %8.1f MB/s\n",
+				idat_count, idat_size, walk, indexed);
+	std::remove(filename.c_str());
+}
+
+void bench_cache(std::size_t file_count, int iterations) {
+	std::vector<std::string> filenames;
+	for (std::size_t i = 0; i < file_count; i++) {
+		filenames.push_back("bench_cache" + std::to_string(i) + ".png");
+		write_file(filenames.back(), png_text_chunk::insert_text_chunks(
+										 make_png(64 * 1024, 4), {{"Software", "bench"}}));
+	}
+	auto run = [&](auto&& extract) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			for (auto& filename : filenames) {
+				extract(filename);
+			}
+		}
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / (iterations * file_count);
+	};
+	auto uncached = run([](auto& filename) { png_text_chunk::extract_text_chunks(filename); });
+	png_text_chunk::MetadataCache cache(1024 * 1024);
+	auto cached = run([&](auto& filename) { cache.get(filename); });
+	auto stats = cache.stats();
+	std::printf("metadata of %zu files: uncached %6.2f us/file, cached %6.2f us/file "
+				"(hits %llu, misses %llu)\n",
+				file_count, uncached, cached, static_cast<unsigned long long>(stats.hits),
+				static_cast<unsigned long long>(stats.misses));
+	for (auto& filename : filenames) {
+		std::remove(filename.c_str());
+	}
+}
+
+void bench_async(std::size_t file_count, int iterations) {
+	std::vector<std::string> filenames;
+	for (std::size_t i = 0; i < file_count; i++) {
+		filenames.push_back("bench_async" + std::to_string(i) + ".png");
+		write_file(filenames.back(),
+				   png_text_chunk::insert_text_chunks(make_png(64 * 1024, 16),
+													  {{"Software", "bench" + std::to_string(i)}}));
+	}
+	auto run = [&](auto&& extract) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			extract();
+		}
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count() / (iterations * file_count);
+	};
+	auto sync = run([&] {
+		for (auto& filename : filenames) {
+			png_text_chunk::extract_text_chunks(filename);
+		}
+	});
+	std::size_t mismatches = 0;
+	png_text_chunk::extract_text_chunks_async(
+		filenames,
+		[&](const std::string& path, std::exception_ptr error,
+			std::unordered_map<std::string, std::string> texts) {
+			if (error || texts != png_text_chunk::extract_text_chunks(path)) {
+				mismatches++;
+			}
+		})
+		.get();
+	auto async = run([&] {
+		png_text_chunk::extract_text_chunks_async(
+			filenames, [](const std::string&, std::exception_ptr,
+						  std::unordered_map<std::string, std::string>) {})
+			.get();
+	});
+	std::printf("extract %zu files: sync %7.2f us/file, async %7.2f us/file%s\n", file_count,
+				sync, async, mismatches ? " MISMATCH" : "");
+	for (auto& filename : filenames) {
+		std::remove(filename.c_str());
+	}
+}
+
+void bench_stream(std::size_t idat_size, std::size_t idat_count, std::size_t packet_size,
+				  int iterations) {
+	auto img = png_text_chunk::insert_text_chunks(make_png(idat_size, idat_count),
+												  {{"Software", "bench"}});
+	auto whole = measure_mb_per_sec(img.size(), iterations,
+									[&] { png_text_chunk::extract_text_chunks(img, true, true); });
+	auto streamed = measure_mb_per_sec(img.size(), iterations, [&] {
+		png_text_chunk::TextChunkParser parser([](std::string, std::string) {});
+		for (std::size_t i = 0; i < img.size(); i += packet_size) {
+			parser.feed(img.data() + i, std::min(packet_size, img.size() - i));
+		}
+	});
+	std::printf("verify+extract %zu bytes: whole buffer %8.1f MB/s, %zu byte packets %8.1f MB/s\n",
+				img.size(), whole, packet_size, streamed);
+}
+
+void bench_update(std::size_t idat_size, int iterations) {
+	std::vector<png_text_chunk::KV> kvs;
+	for (int i = 0; i < 20; i++) {
+		kvs.push_back({"key" + std::to_string(i), "value"});
+	}
+	auto img = png_text_chunk::insert_text_chunks(make_png(idat_size, 1), kvs);
+	png_text_chunk::TextUpdate update{{{"key3", "new"}, {"added", "a"}}, {"key5", "key7"}};
+
+	// repeated set keys, existing or new, must leave one chunk holding the last value
+	png_text_chunk::TextUpdate repeated{{{"key3", "a"}, {"new", "a"}, {"key3", "b"}, {"new", "b"}},
+										{}};
+	auto updated = png_text_chunk::update_text_chunks(img, repeated);
+	std::size_t key3 = 0, added = 0;
+	for (auto& chunk : png_text_chunk::ChunkRange(updated)) {
+		if (chunk.is_text()) {
+			auto key = png_text_chunk::text_chunk_keyword(chunk);
+			key3 += key == "key3";
+			added += key == "new";
+		}
+	}
+	auto texts = png_text_chunk::extract_text_chunks(updated);
+	if (key3 != 1 || added != 1 || texts["key3"] != "b" || texts["new"] != "b") {
+		throw std::runtime_error("update duplicated a repeated key");
+	}
+
+	auto mb_per_sec = measure_mb_per_sec(img.size(), iterations, [&] {
+		png_text_chunk::update_text_chunks(img, update);
+	});
+	std::printf("update 2 keys, remove 2 keys in %zu bytes: %8.1f MB/s\n", img.size(),
+				mb_per_sec);
+}
+
+void bench_update_in_place(std::size_t idat_size, int iterations) {
+	const std::string filename = "bench_update.png";
+	write_file(filename, png_text_chunk::insert_text_chunks(make_png(idat_size, 1),
+															{{"Title", "title"}}, false, true,
+															{}, 16 * 1024));
+	png_text_chunk::TextUpdate update{{{"Title", "new title"}, {"Comment", "comment"}}, {}};
+	auto rewrite = measure_mb_per_sec(idat_size, iterations, [&] {
+		write_file(filename, png_text_chunk::update_text_chunks(filename, update));
+	});
+	auto in_place = measure_mb_per_sec(idat_size, iterations, [&] {
+		png_text_chunk::update_text_chunks_in_place(filename, update);
+	});
+	std::printf("update text of %zu bytes file: rewrite %10.1f MB/s, in place %10.1f MB/s\n",
+				idat_size, rewrite, in_place);
+	std::remove(filename.c_str());
+}
+
+std::size_t peak_rss_bytes() {
+#ifndef _WIN32
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return static_cast<std::size_t>(usage.ru_maxrss);
+#else
+	return static_cast<std::size_t>(usage.ru_maxrss) * 1024;
+#endif
+#else
+	return 0;
+#endif
+}
+
+struct MatrixCase {
+	std::size_t file_size;
+	std::size_t idat_size;
+	std::size_t text_count;
+	std::size_t text_size;
+};
+
+// Repeats `f` for at least `min_time` seconds and prints one JSON object: ns/op, MB/s of
+// `bytes_per_op`, allocations per op and the peak RSS of the process so far.
+template <class F>
+void report(const char* op, const MatrixCase& c, std::size_t bytes_per_op, double min_time,
+			bool& first, F&& f) {
+	f();  // warm up
+	auto allocations = allocation_count.load();
+	std::size_t iterations = 0;
+	auto start = std::chrono::steady_clock::now();
+	std::chrono::duration<double> elapsed{};
+	do {
+		f();
+		iterations++;
+		elapsed = std::chrono::steady_clock::now() - start;
+	} while (elapsed.count() < min_time);
+	auto ns_per_op = elapsed.count() * 1e9 / iterations;
+	std::printf("%s\n  {\"op\": \"%s\", \"file_size\": %zu, \"idat_size\": %zu, "
+				"\"text_count\": %zu, \"text_size\": %zu, \"iterations\": %zu, "
+				"\"ns_per_op\": %.1f, \"mb_per_sec\": %.1f, \"allocs_per_op\": %.1f, "
+				"\"peak_rss_bytes\": %zu}",
+				first ? "" : ",", op, c.file_size, c.idat_size, c.text_count, c.text_size,
+				iterations, ns_per_op, bytes_per_op / (ns_per_op / 1e9) / (1024 * 1024),
+				static_cast<double>(allocation_count.load() - allocations) / iterations,
+				peak_rss_bytes());
+	std::fflush(stdout);
+	first = false;
+}
+
+// Benchmarks every read and write path over file sizes up to `max_size`, IDAT splits and
+// text chunk counts and sizes, as a JSON array.
+void run_matrix(std::size_t max_size, double min_time) {
+	bool first = true;
+	std::printf("[");
+	for (std::size_t size : {std::size_t(10) << 10, std::size_t(1) << 20, std::size_t(64) << 20,
+							 std::size_t(1) << 30}) {
+		if (size > max_size) {
+			continue;
+		}
+		std::vector<char> buffer(size);
+		MatrixCase c{size, size, 0, 0};
+		volatile std::uint32_t sink = 0;
+		report("crc", c, size, min_time, first,
+			   [&] { sink = png_text_chunk::calculate_crc(buffer.data(), buffer.size()); });
+	}
+	for (std::size_t text_size : {16, 4096, 1 << 20}) {
+		std::string value(text_size, 'x');
+		MatrixCase c{0, 0, 1, text_size};
+		report("generate_text_chunk", c, text_size, min_time, first,
+			   [&] { png_text_chunk::generate_text_chunk<char>("Comment", value); });
+	}
+
+	// inputs come from the corpus generator, one seeded stream per image, so every run and
+	// png_text_chunk_corpus --seed 0 draw the same bytes
+	namespace corpus = png_text_chunk::corpus;
+	const std::string filename = "bench_matrix.png";
+	std::size_t file_index = 0;
+	for (std::size_t size : {std::size_t(10) << 10, std::size_t(1) << 20, std::size_t(64) << 20,
+							 std::size_t(1) << 30}) {
+		if (size > max_size) {
+			continue;
+		}
+		// a single IDAT, or IDATs of 8 KiB
+		for (std::size_t idat_split : {2 * size, std::size_t(8) << 10}) {
+			corpus::Profile profile;
+			profile.image_size = size;
+			profile.idat_split = idat_split;
+			profile.texts = 0;
+			auto rng = corpus::file_rng(0, file_index++);
+			auto base = corpus::make_png(rng, profile);
+			std::size_t idat_size = 0;
+			for (auto& chunk : png_text_chunk::ChunkRange(base)) {
+				if (chunk.type == png_text_chunk::tag::IDAT) {
+					idat_size = std::max<std::size_t>(idat_size, chunk.length);
+				}
+			}
+			// restored before each vector insert, which grows its argument in place
+			std::vector<char> work;
+			work.reserve(base.size() + (1 << 20));	// room for the largest text set
+			for (std::size_t text_count : {1, 50}) {
+				for (std::size_t text_size : {16, 4096}) {
+					std::vector<png_text_chunk::KV> kvs;
+					for (std::size_t i = 0; i < text_count; i++) {
+						kvs.push_back(
+							{"key" + std::to_string(i), corpus::make_text(rng, text_size)});
+					}
+					auto img = png_text_chunk::insert_text_chunks(base, kvs);
+					std::vector<unsigned char> uimg(img.begin(), img.end());
+					write_file(filename, img);
+					MatrixCase c{img.size(), idat_size, text_count, text_size};
+					report("extract_filename", c, img.size(), min_time, first,
+						   [&] { png_text_chunk::extract_text_chunks(filename); });
+					report("extract_vector_char", c, img.size(), min_time, first,
+						   [&] { png_text_chunk::extract_text_chunks(img); });
+					report("extract_vector_uchar", c, img.size(), min_time, first,
+						   [&] { png_text_chunk::extract_text_chunks(uimg); });
+					report("insert_pointer", c, img.size(), min_time, first, [&] {
+						png_text_chunk::insert_text_chunks<char>(
+							reinterpret_cast<const unsigned char*>(base.data()), base.size(), kvs);
+					});
+					report("insert_vector", c, img.size(), min_time, first, [&] {
+						work.assign(base.begin(), base.end());
+						png_text_chunk::insert_text_chunks(work, kvs);
+					});
+					report("insert_ifstream", c, img.size(), min_time, first, [&] {
+						std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+						png_text_chunk::insert_text_chunks<char>(ifs, kvs);
+					});
+				}
+			}
+		}
+	}
+	std::remove(filename.c_str());
+	std::printf("\n]\n");
+}
+
+constexpr auto USAGE =
+	"usage: png_text_chunk_bench [--json [--max-size <bytes>] [--min-time <seconds>]]\n"
+	"Without --json, runs the human-readable benchmarks. With --json, runs the matrix of\n"
+	"read/write paths (file sizes up to --max-size, 64 MiB by default) as a JSON array,\n"
+	"on images drawn from the png_text_chunk_corpus generator with seed 0.\n";
+
+int main(int argc, char** argv) {
+	bool json = false;
+	std::size_t max_size = std::size_t(64) << 20;
+	double min_time = 0.2;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--json") {
+			json = true;
+		} else if (arg == "--max-size" && i + 1 < argc) {
+			max_size = std::stoull(argv[++i]);
+		} else if (arg == "--min-time" && i + 1 < argc) {
+			min_time = std::stod(argv[++i]);
+		} else {
+			std::fprintf(stderr, "%s", USAGE);
+			return 2;
+		}
+	}
+	if (json) {
+		run_matrix(max_size, min_time);
+		return 0;
+	}
+
+	bench_crc(63, 200000);
+	bench_crc(64, 200000);
+	bench_crc(4 * 1024, 5000);
+	bench_crc(1024 * 1024, 20);
+	bench_crc(16 * 1024 * 1024, 2);
+	bench_verify(8 * 1024, 4096, 5);
+	bench_verify(32 * 1024 * 1024, 4, 5);
+	bench_insert(64 * 1024 * 1024, 50, 3);
+	bench_update(64 * 1024 * 1024, 3);
+	bench_update_in_place(64 * 1024 * 1024, 3);
+	bench_selected(40, 1024 * 1024, 5);
+	bench_arena(64, 16, 20000);
+	bench_arena(64, 1024, 20000);
+	bench_index(8 * 1024, 4096, 200);
+	bench_cache(64, 200);
+	bench_async(64, 20);
+	bench_stream(8 * 1024, 4096, 1500, 5);
+#ifdef PNG_TEXT_CHUNK_USE_ZLIB
+	bench_compression(200 * 1024, 20);
+	bench_parallel_inflate(32, 1024 * 1024, 3);
+#endif
+	return 0;
+}
@@ -0,0 +1,484 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "png_text_chunk.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#include <filesystem>
+#endif
+
+namespace png_text_chunk {
+// Identifies one version of a file: any rewrite changes the size or the mtime.
+struct FileIdentity {
+	std::uint64_t device = 0;
+	std::uint64_t inode = 0;
+	std::uint64_t size = 0;
+	std::int64_t mtime_ns = 0;
+
+	bool operator==(const FileIdentity& other) const {
+		return device == other.device && inode == other.inode && size == other.size &&
+			   mtime_ns == other.mtime_ns;
+	}
+	bool operator!=(const FileIdentity& other) const { return !(*this == other); }
+};
+
+// Device and inode of a file, the key the caches look files up by.
+using FileKey = std::pair<std::uint64_t, std::uint64_t>;
+
+struct FileKeyHash {
+	std::size_t operator()(const FileKey& key) const {
+		return std::hash<std::uint64_t>()(key.first * 0x9e3779b97f4a7c15ull ^ key.second);
+	}
+};
+
+inline FileIdentity file_identity(const std::string& filename) {
+#ifndef _WIN32
+	struct stat st {};
+	if (::stat(filename.c_str(), &st) != 0) {
+		throw std::runtime_error("cannot open a file");
+	}
+#ifdef __APPLE__
+	const auto& mtime = st.st_mtimespec;
+#else
+	const auto& mtime = st.st_mtim;
+#endif
+	return {static_cast<std::uint64_t>(st.st_dev), static_cast<std::uint64_t>(st.st_ino),
+			static_cast<std::uint64_t>(st.st_size),
+			static_cast<std::int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec};
+#else
+	std::error_code ec;
+	auto size = std::filesystem::file_size(filename, ec);
+	if (ec) {
+		throw std::runtime_error("cannot open a file");
+	}
+	auto mtime = std::filesystem::last_write_time(filename, ec).time_since_epoch();
+	return {0, 0, size, std::chrono::duration_cast<std::chrono::nanoseconds>(mtime).count()};
+#endif
+}
+
+// Positional reads and writes: pread/pwrite on POSIX, seek + read/write elsewhere.
+class RandomAccessFile {
+   public:
+	explicit RandomAccessFile(const std::string& filename, bool writable = false) {
+#ifndef _WIN32
+		fd_ = ::open(filename.c_str(), (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+		PNG_TEXT_CHUNK_STAT(syscalls, 1);
+		if (fd_ < 0) {
+			throw std::runtime_error("cannot open a file");
+		}
+#else
+		fs_.open(filename, std::ios::in | (writable ? std::ios::out : std::ios::openmode()) |
+							   std::ios::binary);
+		if (fs_.fail()) {
+			throw std::runtime_error("cannot open a file");
+		}
+#endif
+	}
+	~RandomAccessFile() {
+#ifndef _WIN32
+		::close(fd_);
+		PNG_TEXT_CHUNK_STAT(syscalls, 1);
+#endif
+	}
+	RandomAccessFile(const RandomAccessFile&) = delete;
+	RandomAccessFile& operator=(const RandomAccessFile&) = delete;
+
+	// Reads exactly `size` bytes at `offset`, or returns false at EOF.
+	bool read_at(std::uint64_t offset, void* out, std::size_t size) {
+#ifndef _WIN32
+		auto p = static_cast<char*>(out);
+		while (size > 0) {
+			ssize_t n = ::pread(fd_, p, size, static_cast<off_t>(offset));
+			PNG_TEXT_CHUNK_STAT(syscalls, 1);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				return false;
+			}
+			PNG_TEXT_CHUNK_STAT(bytes_read, n);
+			p += n;
+			offset += static_cast<std::uint64_t>(n);
+			size -= static_cast<std::size_t>(n);
+		}
+		return true;
+#else
+		fs_.clear();
+		fs_.seekg(offset);
+		fs_.read(static_cast<char*>(out), size);
+		PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+		PNG_TEXT_CHUNK_STAT(bytes_read, fs_.gcount());
+		return static_cast<std::size_t>(fs_.gcount()) == size;
+#endif
+	}
+
+	void write_at(std::uint64_t offset, const void* data, std::size_t size) {
+#ifndef _WIN32
+		auto p = static_cast<const char*>(data);
+		while (size > 0) {
+			ssize_t n = ::pwrite(fd_, p, size, static_cast<off_t>(offset));
+			PNG_TEXT_CHUNK_STAT(syscalls, 1);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n < 0) {
+				throw std::runtime_error("failed to write a file");
+			}
+			p += n;
+			offset += static_cast<std::uint64_t>(n);
+			size -= static_cast<std::size_t>(n);
+		}
+#else
+		fs_.clear();
+		fs_.seekp(offset);
+		fs_.write(static_cast<const char*>(data), size);
+		fs_.flush();
+		if (fs_.fail()) {
+			throw std::runtime_error("failed to write a file");
+		}
+#endif
+	}
+
+   private:
+#ifndef _WIN32
+	int fd_ = -1;
+#else
+	std::fstream fs_;
+#endif
+};
+
+struct ChunkEntry {
+	std::uint32_t type;
+	std::uint64_t offset;  // offset of the chunk's length field
+	std::uint32_t length;
+	std::uint32_t crc;	  // stored CRC
+	std::string keyword;  // text chunks only
+};
+
+// Chunk layout of one file version. Building it reads only chunk headers and text keywords;
+// afterwards each text lookup costs one positional read.
+class ChunkIndex {
+   public:
+	FileIdentity identity;
+	std::vector<ChunkEntry> chunks;
+
+	static ChunkIndex build(const std::string& filename) {
+		ChunkIndex index;
+		index.identity = file_identity(filename);
+		RandomAccessFile file(filename);
+		std::array<unsigned char, 8> header{};
+		if (!file.read_at(0, header.data(), header.size()) ||
+			!is_valid_png(header.data(), header.size())) {
+			throw std::runtime_error("png signature not found");
+		}
+		std::uint64_t offset = 8;
+		while (offset < index.identity.size) {
+			if (!file.read_at(offset, header.data(), header.size())) {
+				throw std::runtime_error("chunk is truncated at offset " + std::to_string(offset));
+			}
+			ChunkEntry entry{swap_endian(header.data() + 4), offset, swap_endian(header.data()),
+							 0, {}};
+			std::array<unsigned char, 4> crc{};
+			if (!file.read_at(offset + 8 + entry.length, crc.data(), crc.size())) {
+				throw std::runtime_error("chunk is truncated at offset " + std::to_string(offset));
+			}
+			entry.crc = swap_endian(crc.data());
+			if (entry.type == tag::tEXt || entry.type == tag::iTXt || entry.type == tag::zTXt) {
+				std::array<char, 80> keyword{};
+				auto size = std::min<std::size_t>(entry.length, keyword.size());
+				file.read_at(offset + 8, keyword.data(), size);
+				entry.keyword.assign(keyword.data(), strnlen(keyword.data(), size));
+			}
+			index.chunks.push_back(std::move(entry));
+			if (index.chunks.back().type == tag::IEND) {
+				break;
+			}
+			offset += index.chunks.back().length + 12ull;
+		}
+		return index;
+	}
+
+	// Text of the text chunks whose keyword is `key` (all text chunks if empty), read with
+	// one positional read each.
+	std::unordered_map<std::string, std::string> extract_text(
+		const std::string& filename, const std::string& key = "", bool verify_crc = true,
+		std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) const {
+		RandomAccessFile file(filename);
+		std::unordered_map<std::string, std::string> ret;
+		std::vector<unsigned char> buffer;
+		for (auto& entry : chunks) {
+			if (entry.keyword.empty() || (!key.empty() && entry.keyword != key)) {
+				continue;
+			}
+			buffer.resize(4 + entry.length + 4);
+			if (!file.read_at(entry.offset + 4, buffer.data(), buffer.size())) {
+				throw std::runtime_error("chunk is truncated at offset " +
+										 std::to_string(entry.offset));
+			}
+			ChunkView chunk{entry.type, buffer.data() + 4, entry.length, entry.crc,
+							static_cast<std::size_t>(entry.offset)};
+			if (verify_crc) {
+				check_crc(chunk);
+			}
+			auto [k, v] = decode_text_chunk(chunk, max_text_size);
+			ret[std::move(k)] = std::move(v);
+		}
+		return ret;
+	}
+
+	std::optional<std::string> lookup(const std::string& filename, const std::string& key,
+									  bool verify_crc = true) const {
+		auto texts = extract_text(filename, key, verify_crc);
+		auto it = texts.find(key);
+		if (it == texts.end()) {
+			return std::nullopt;
+		}
+		return std::move(it->second);
+	}
+
+	// Sidecar format (little endian): "PTCI", version, identity, chunk count, then per chunk
+	// type, offset, length, CRC, keyword length and keyword.
+	void save(const std::string& path) const {
+		std::string out = "PTCI";
+		put(out, VERSION);
+		put(out, identity.device);
+		put(out, identity.inode);
+		put(out, identity.size);
+		put(out, static_cast<std::uint64_t>(identity.mtime_ns));
+		put(out, static_cast<std::uint32_t>(chunks.size()));
+		for (auto& entry : chunks) {
+			put(out, entry.type);
+			put(out, entry.offset);
+			put(out, entry.length);
+			put(out, entry.crc);
+			out.push_back(static_cast<char>(entry.keyword.size()));
+			out += entry.keyword;
+		}
+		std::ofstream ofs(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		ofs.write(out.data(), out.size());
+		if (ofs.fail()) {
+			throw std::runtime_error("failed to write an index file");
+		}
+	}
+
+	// Loads a sidecar written by save(); nullopt if it is missing, unreadable, or describes
+	// another version of `filename`.
+	static std::optional<ChunkIndex> load(const std::string& path, const std::string& filename) {
+		std::ifstream ifs(path, std::ios::in | std::ios::binary);
+		if (ifs.fail()) {
+			return std::nullopt;
+		}
+		std::string in((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+		PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+		PNG_TEXT_CHUNK_STAT(bytes_read, in.size());
+		std::size_t pos = 4;
+		std::uint32_t version = 0, count = 0;
+		std::uint64_t mtime = 0;
+		ChunkIndex index;
+		if (in.compare(0, 4, "PTCI") != 0 || !get(in, pos, version) || version != VERSION ||
+			!get(in, pos, index.identity.device) || !get(in, pos, index.identity.inode) ||
+			!get(in, pos, index.identity.size) || !get(in, pos, mtime) || !get(in, pos, count)) {
+			return std::nullopt;
+		}
+		index.identity.mtime_ns = static_cast<std::int64_t>(mtime);
+		if (index.identity != file_identity(filename)) {
+			return std::nullopt;
+		}
+		for (std::uint32_t i = 0; i < count; i++) {
+			ChunkEntry entry{};
+			if (!get(in, pos, entry.type) || !get(in, pos, entry.offset) ||
+				!get(in, pos, entry.length) || !get(in, pos, entry.crc) || pos >= in.size()) {
+				return std::nullopt;
+			}
+			std::size_t keyword_size = static_cast<unsigned char>(in[pos++]);
+			if (in.size() - pos < keyword_size) {
+				return std::nullopt;
+			}
+			entry.keyword = in.substr(pos, keyword_size);
+			pos += keyword_size;
+			index.chunks.push_back(std::move(entry));
+		}
+		return index;
+	}
+
+   private:
+	static constexpr std::uint32_t VERSION = 1;
+
+	template <typename U>
+	static void put(std::string& out, U value) {
+		for (std::size_t i = 0; i < sizeof(U); i++) {
+			out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+		}
+	}
+
+	template <typename U>
+	static bool get(const std::string& in, std::size_t& pos, U& value) {
+		if (in.size() - pos < sizeof(U)) {
+			return false;
+		}
+		value = 0;
+		for (std::size_t i = 0; i < sizeof(U); i++) {
+			value |= static_cast<U>(static_cast<unsigned char>(in[pos + i])) << (8 * i);
+		}
+		pos += sizeof(U);
+		return true;
+	}
+};
+
+// Loads the sidecar at `index_path` if it matches `filename`, otherwise rebuilds and saves it.
+inline ChunkIndex load_or_build_index(const std::string& filename, const std::string& index_path) {
+	if (auto index = ChunkIndex::load(index_path, filename)) {
+		return std::move(*index);
+	}
+	auto index = ChunkIndex::build(filename);
+	index.save(index_path);
+	return index;
+}
+
+// Thread-safe LRU of chunk indexes keyed by file identity, holding at most `capacity` files.
+class ChunkIndexCache {
+   public:
+	explicit ChunkIndexCache(std::size_t capacity) : capacity_(capacity) {}
+
+	std::shared_ptr<const ChunkIndex> get(const std::string& filename) {
+		auto identity = file_identity(filename);
+		auto key = std::make_pair(identity.device, identity.inode);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			auto it = map_.find(key);
+			if (it != map_.end()) {
+				if (it->second->second->identity == identity) {
+					lru_.splice(lru_.begin(), lru_, it->second);
+					return lru_.front().second;
+				}
+				lru_.erase(it->second);
+				map_.erase(it);
+			}
+		}
+
+		// built outside the lock; concurrent misses on one file may both build it
+		auto index = std::make_shared<const ChunkIndex>(ChunkIndex::build(filename));
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto it = map_.find(key);
+		if (it != map_.end()) {
+			lru_.erase(it->second);
+			map_.erase(it);
+		}
+		lru_.emplace_front(key, index);
+		map_[key] = lru_.begin();
+		while (lru_.size() > capacity_) {
+			map_.erase(lru_.back().first);
+			lru_.pop_back();
+		}
+		return index;
+	}
+
+   private:
+	using Key = FileKey;
+	using Lru = std::list<std::pair<Key, std::shared_ptr<const ChunkIndex>>>;
+
+	std::size_t capacity_;
+	std::mutex mutex_;
+	Lru lru_;
+	std::unordered_map<Key, Lru::iterator, FileKeyHash> map_;
+};
+
+// Applies `update` to `filename` without moving any other byte of the file, using the ptPd
+// chunk reserved at insert time (see the `padding` argument of insert_text_chunks). The text
+// chunks directly before the padding are rewritten with the padding shrunk or grown to keep
+// the size. Matching text chunks elsewhere are zeroed and retyped as padding. Throws, leaving
+// the file untouched, when there is no padding or it is too small.
+inline void update_text_chunks_in_place(const std::string& filename, const TextUpdate& update,
+										bool utf8 = false, const Compression& compression = {}) {
+	auto index = ChunkIndex::build(filename);
+	auto is_text = [](std::uint32_t type) {
+		return type == tag::tEXt || type == tag::iTXt || type == tag::zTXt;
+	};
+	auto pad = std::find_if(index.chunks.begin(), index.chunks.end(),
+							[](const ChunkEntry& entry) { return entry.type == tag::ptPd; });
+	if (pad == index.chunks.end()) {
+		throw std::runtime_error("no padding is reserved");
+	}
+	auto first = pad;
+	while (first != index.chunks.begin() && is_text((first - 1)->type)) {
+		--first;
+	}
+
+	// text chunks of the region, followed by the padding
+	auto region_offset = first->offset;
+	auto region_size = static_cast<std::size_t>(pad->offset + pad->length + 12 - region_offset);
+	RandomAccessFile file(filename, true);
+	std::vector<unsigned char> region(region_size);
+	auto texts_size = static_cast<std::size_t>(pad->offset - region_offset);
+	if (!file.read_at(region_offset, region.data(), texts_size)) {
+		throw std::runtime_error("chunk is truncated at offset " + std::to_string(region_offset));
+	}
+	for (auto& chunk : ChunkRange(region.data(), texts_size, 0)) {
+		check_crc(chunk);
+	}
+
+	auto plan = plan_text_update(region.data(), texts_size, 0, update);
+	plan.add_unplaced(plan.pieces.size());
+	auto compressed = compress_values(update.set, compression);
+	auto size = planned_size(plan, update, utf8, compressed);
+	auto rest = region_size - std::min(size, region_size);
+	if (size > region_size || (rest > 0 && rest < 12)) {
+		throw std::runtime_error("reserved padding is too small");
+	}
+	std::vector<unsigned char> out(region_size);
+	auto end = write_planned(out.data(), region.data(), plan, update, utf8, compressed);
+	if (rest > 0) {
+		write_padding_chunk(end, rest - 12);
+	}
+
+	std::vector<std::string> keys = update.remove;
+	for (auto& kv : update.set) {
+		keys.push_back(kv.first);
+	}
+	KeySet touched(std::move(keys));
+	std::vector<const ChunkEntry*> stale;
+	for (auto it = index.chunks.begin(); it != index.chunks.end(); ++it) {
+		if ((it < first || it > pad) && is_text(it->type) && touched.contains(it->keyword)) {
+			stale.push_back(&*it);
+		}
+	}
+
+	// When the old padding holds zeros, as written at insert time, the part of it that stays
+	// padding is left alone and only the bytes before it and the CRC are written.
+	std::vector<unsigned char> zero_padding(4 + pad->length);
+	std::memcpy(zero_padding.data(), "ptPd", 4);
+	auto written = region_size;
+	if (rest > 0 && calculate_crc(zero_padding.data(), zero_padding.size()) == pad->crc) {
+		auto old_zeros = texts_size + 8;
+		auto new_zeros = static_cast<std::size_t>(end - out.data()) + 8;
+		written = std::min(std::max(old_zeros, new_zeros), region_size - 4);
+	}
+	file.write_at(region_offset, out.data(), written);
+	if (written < region_size) {
+		file.write_at(region_offset + region_size - 4, out.data() + region_size - 4, 4);
+	}
+	for (auto entry : stale) {
+		std::vector<unsigned char> padding(12ull + entry->length);
+		write_padding_chunk(padding.data(), entry->length);
+		file.write_at(entry->offset, padding.data(), padding.size());
+	}
+}
+}  // namespace png_text_chunk
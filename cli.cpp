@@ -0,0 +1,320 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "png_text_chunk.hpp"
+#include "thread_pool.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+constexpr auto USAGE =
+	"usage: png_text_chunk_cli extract [-j N] <paths...>\n"
+	"       png_text_chunk_cli verify  [-j N] <paths...>\n"
+	"       png_text_chunk_cli insert  [-j N] [--utf8] [-z <min size>] [--level <1-9>]\n"
+	"                                  [--pad <bytes>] -k <key=value>... -o <dir> <paths...>\n"
+	"--stats adds per-file counters to each line (needs a PNG_TEXT_CHUNK_STATS build).\n"
+	"Directories are searched recursively for *.png. Results are written as JSON Lines.\n";
+
+struct Options {
+	std::string command;
+	std::size_t threads = std::thread::hardware_concurrency();
+	bool utf8 = false;
+	png_text_chunk::Compression compression;
+	std::size_t padding = 0;
+	bool stats = false;
+	std::vector<png_text_chunk::KV> kvs;
+	fs::path output_dir;
+	std::vector<fs::path> paths;
+};
+
+// Length of the well-formed UTF-8 sequence starting at s[i], or 0 if there is none.
+std::size_t utf8_sequence_length(std::string_view s, std::size_t i) {
+	auto at = [&](std::size_t k) { return static_cast<unsigned char>(s[k]); };
+	auto lead = at(i);
+	std::size_t len = lead < 0x80 ? 1 : lead >= 0xc2 && lead <= 0xdf ? 2
+							  : lead >= 0xe0 && lead <= 0xef		 ? 3
+							  : lead >= 0xf0 && lead <= 0xf4		 ? 4
+																	 : 0;
+	if (len == 0 || s.size() - i < len) {
+		return 0;
+	}
+	for (std::size_t k = 1; k < len; ++k) {
+		if ((at(i + k) & 0xc0) != 0x80) {
+			return 0;
+		}
+	}
+	// reject overlong forms, surrogates and code points above U+10FFFF
+	auto second = at(i + 1);
+	if ((lead == 0xe0 && second < 0xa0) || (lead == 0xed && second >= 0xa0) ||
+		(lead == 0xf0 && second < 0x90) || (lead == 0xf4 && second >= 0x90)) {
+		return 0;
+	}
+	return len;
+}
+
+// Latin-1 (tEXt) bytes are converted to UTF-8; iTXt should already be UTF-8, and each byte
+// that is not part of a well-formed sequence becomes U+FFFD so the line stays valid JSON.
+void append_json_string(std::string& out, std::string_view s, bool latin1 = false) {
+	out.push_back('"');
+	for (std::size_t i = 0; i < s.size(); ++i) {
+		char c = s[i];
+		auto uc = static_cast<unsigned char>(c);
+		if (c == '"' || c == '\\') {
+			out.push_back('\\');
+			out.push_back(c);
+		} else if (uc < 0x20) {
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", uc);
+			out += escaped;
+		} else if (uc < 0x80) {
+			out.push_back(c);
+		} else if (latin1) {
+			out.push_back(static_cast<char>(0xc0 | (uc >> 6)));
+			out.push_back(static_cast<char>(0x80 | (uc & 0x3f)));
+		} else if (auto len = utf8_sequence_length(s, i)) {
+			out.append(s.substr(i, len));
+			i += len - 1;
+		} else {
+			out += "\xef\xbf\xbd";
+		}
+	}
+	out.push_back('"');
+}
+
+bool is_png_path(const fs::path& path) {
+	auto ext = path.extension().string();
+	std::transform(ext.begin(), ext.end(), ext.begin(),
+				   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return ext == ".png";
+}
+
+void extract(const fs::path& path, std::string& line) {
+	png_text_chunk::MappedFile file(path.string());
+	auto texts = png_text_chunk::extract_text_chunk_views(file.data(), file.size());
+	std::string inflated;
+	line += ",\"text\":[";
+	for (std::size_t i = 0; i < texts.size(); i++) {
+		std::string_view value = texts[i].value;
+		if (texts[i].compressed) {
+			inflated = png_text_chunk::inflate_text(value);
+			value = inflated;
+		}
+		line += i == 0 ? "{\"key\":" : ",{\"key\":";
+		append_json_string(line, texts[i].key, true);
+		line += ",\"value\":";
+		append_json_string(line, value, texts[i].type != png_text_chunk::tag::iTXt);
+		line += "}";
+	}
+	line += "]";
+}
+
+void verify(const fs::path& path, std::string& line) {
+	auto corrupt = png_text_chunk::find_corrupt_chunk(path.string());
+	if (!corrupt) {
+		line += ",\"ok\":true";
+		return;
+	}
+	line += ",\"ok\":false,\"chunk\":";
+	append_json_string(line, corrupt->name, true);
+	line += ",\"offset\":" + std::to_string(corrupt->offset);
+}
+
+void insert(const Options& options, const fs::path& path, const fs::path& root,
+			std::string& line) {
+	auto relative = (path == root) ? path.filename() : path.lexically_relative(root);
+	auto output = options.output_dir / relative;
+	std::error_code ec;
+	if (fs::equivalent(path, output, ec)) {
+		throw std::runtime_error("output is the input file: " + output.string());
+	}
+	fs::create_directories(output.parent_path(), ec);
+	if (ec) {
+		throw std::runtime_error("cannot create " + output.parent_path().string() + ": " +
+								 ec.message());
+	}
+	png_text_chunk::insert_text_chunks_stream(path.string(), output.string(), options.kvs,
+											  options.utf8, true, options.compression,
+											  options.padding);
+	line += ",\"output\":";
+	append_json_string(line, output.string());
+}
+
+void append_stats(std::string& line, const png_text_chunk::Stats& s) {
+	auto field = [&line](const char* name, std::uint64_t value) {
+		line += ",\"";
+		line += name;
+		line += "\":" + std::to_string(value);
+	};
+	line += ",\"stats\":{\"bytes_read\":" + std::to_string(s.bytes_read);
+	field("syscalls", s.syscalls);
+	field("stream_reads", s.stream_reads);
+	field("chunks", s.chunks.total());
+	field("text_chunks", s.chunks.tEXt + s.chunks.zTXt + s.chunks.iTXt);
+	field("idat_chunks", s.chunks.IDAT);
+	field("crc_bytes", s.crc_bytes);
+	field("bytes_copied", s.bytes_copied);
+	field("allocations", s.allocations);
+	field("scan_ns", s.scan_ns);
+	field("crc_ns", s.crc_ns);
+	field("decode_ns", s.decode_ns);
+	field("write_ns", s.write_ns);
+	line += "}";
+}
+
+Options parse_args(int argc, char** argv) {
+	if (argc < 2) {
+		throw std::invalid_argument("no command");
+	}
+	Options options;
+	options.command = argv[1];
+	if (options.command != "extract" && options.command != "verify" &&
+		options.command != "insert") {
+		throw std::invalid_argument("unknown command: " + options.command);
+	}
+	for (int i = 2; i < argc; i++) {
+		std::string arg = argv[i];
+		auto value = [&] {
+			if (i + 1 >= argc) {
+				throw std::invalid_argument("missing value for " + arg);
+			}
+			return std::string(argv[++i]);
+		};
+		if (arg == "-j") {
+			options.threads = std::stoul(value());
+		} else if (arg == "--utf8") {
+			options.utf8 = true;
+		} else if (arg == "-z") {
+			options.compression.min_size = std::stoul(value());
+		} else if (arg == "--level") {
+			options.compression.level = std::stoi(value());
+		} else if (arg == "--pad") {
+			options.padding = std::stoul(value());
+		} else if (arg == "--stats") {
+			if (!png_text_chunk::stats_enabled) {
+				throw std::invalid_argument("--stats needs a build with PNG_TEXT_CHUNK_STATS");
+			}
+			options.stats = true;
+		} else if (arg == "-k") {
+			auto kv = value();
+			auto eq = kv.find('=');
+			if (eq == std::string::npos) {
+				throw std::invalid_argument("-k expects key=value: " + kv);
+			}
+			options.kvs.push_back({kv.substr(0, eq), kv.substr(eq + 1)});
+		} else if (arg == "-o") {
+			options.output_dir = value();
+		} else {
+			options.paths.emplace_back(arg);
+		}
+	}
+	if (options.paths.empty()) {
+		throw std::invalid_argument("no input paths");
+	}
+	if (options.command == "insert" && (options.kvs.empty() || options.output_dir.empty())) {
+		throw std::invalid_argument("insert needs -k and -o");
+	}
+	return options;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+	Options options;
+	try {
+		options = parse_args(argc, argv);
+	} catch (const std::exception& e) {
+		std::fprintf(stderr, "%s\n%s", e.what(), USAGE);
+		return 2;
+	}
+
+	png_text_chunk::ThreadPool pool(options.threads);
+	// per-worker output line, reused across files
+	std::vector<std::string> lines(pool.size());
+	std::mutex output_mutex;
+	std::atomic<bool> failed{false};
+
+	auto process = [&](fs::path path, fs::path root) {
+		auto& line = lines[png_text_chunk::ThreadPool::current_worker()];
+		line = "{\"path\":";
+		append_json_string(line, path.string());
+		auto prefix = line.size();
+		if (options.stats) {
+			png_text_chunk::take_thread_stats();
+		}
+		try {
+			if (options.command == "extract") {
+				extract(path, line);
+			} else if (options.command == "verify") {
+				verify(path, line);
+			} else {
+				insert(options, path, root, line);
+			}
+		} catch (const std::exception& e) {
+			line.resize(prefix);
+			line += ",\"error\":";
+			append_json_string(line, e.what());
+			failed = true;
+		}
+		if (options.stats) {
+			append_stats(line, png_text_chunk::take_thread_stats());
+		}
+		line += "}\n";
+		std::lock_guard<std::mutex> lock(output_mutex);
+		std::fwrite(line.data(), 1, line.size(), stdout);
+	};
+
+	auto report = [&](const fs::path& path, const std::error_code& ec) {
+		std::string line = "{\"path\":";
+		append_json_string(line, path.string());
+		line += ",\"error\":";
+		append_json_string(line, ec.message());
+		line += "}\n";
+		failed = true;
+		std::lock_guard<std::mutex> lock(output_mutex);
+		std::fwrite(line.data(), 1, line.size(), stdout);
+	};
+
+	// not walked, so re-running insert does not pick up its own outputs
+	fs::path output_dir;
+	if (options.command == "insert") {
+		std::error_code ec;
+		output_dir = fs::weakly_canonical(options.output_dir, ec);
+	}
+
+	// Directories are walked one directory_iterator at a time: recursive_directory_iterator
+	// ends at its first error, which would drop the rest of the tree.
+	for (auto& root : options.paths) {
+		std::error_code ec;
+		if (!fs::is_directory(root, ec)) {
+			pool.submit([&process, root] { process(root, root); });
+			continue;
+		}
+		std::vector<fs::path> dirs{root};
+		while (!dirs.empty()) {
+			auto dir = std::move(dirs.back());
+			dirs.pop_back();
+			fs::directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec);
+			for (; !ec && it != fs::directory_iterator(); it.increment(ec)) {
+				auto path = it->path();
+				if (it->is_directory(ec) && !it->is_symlink(ec)) {
+					if (output_dir.empty() || fs::weakly_canonical(path, ec) != output_dir) {
+						dirs.push_back(std::move(path));
+					}
+				} else if (it->is_regular_file(ec) && is_png_path(path)) {
+					pool.submit([&process, path, root] { process(path, root); });
+				}
+			}
+			if (ec) {
+				report(dir, ec);
+			}
+		}
+	}
+	pool.wait();
+	std::fflush(stdout);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,145 @@
+#include <cstdio>
+#include <filesystem>
+
+#include "corpus.hpp"
+
+namespace fs = std::filesystem;
+namespace corpus = png_text_chunk::corpus;
+
+namespace {
+constexpr auto USAGE =
+	"usage: png_text_chunk_corpus [--profile <name>] [--seed N] [--count N] -o <dir>\n"
+	"                             [--image-size <bytes>] [--idat-split <bytes>]\n"
+	"                             [--texts N] [--text-size <bytes>] [--compress none|ztxt|itxt]\n"
+	"                             [--placement before|after|both]\n"
+	"Profiles: tiny_idats, huge_idat, many_texts, big_itxt, mixed (default).\n"
+	"The same seed, profile and options always produce the same files.\n";
+
+struct Options {
+	std::string profile = "mixed";
+	std::uint64_t seed = 0;
+	std::size_t count = 16;
+	fs::path output_dir;
+	corpus::Profile overrides;
+	std::vector<std::string> overridden;  // names of the options given explicitly
+};
+
+void apply_overrides(corpus::Profile& p, const Options& options) {
+	for (auto& name : options.overridden) {
+		auto& o = options.overrides;
+		if (name == "--image-size") {
+			p.image_size = o.image_size;
+		} else if (name == "--idat-split") {
+			p.idat_split = o.idat_split;
+		} else if (name == "--texts") {
+			p.texts = o.texts;
+		} else if (name == "--text-size") {
+			p.text_size = o.text_size;
+		} else if (name == "--compress") {
+			p.kind = o.kind;
+		} else if (name == "--placement") {
+			p.placement = o.placement;
+		}
+	}
+}
+
+Options parse_args(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		auto value = [&] {
+			if (i + 1 >= argc) {
+				throw std::invalid_argument("missing value for " + arg);
+			}
+			return std::string(argv[++i]);
+		};
+		auto& o = options.overrides;
+		if (arg == "--profile") {
+			options.profile = value();
+			corpus::preset(options.profile);
+		} else if (arg == "--seed") {
+			options.seed = std::stoull(value());
+		} else if (arg == "--count") {
+			options.count = std::stoul(value());
+		} else if (arg == "-o") {
+			options.output_dir = value();
+		} else if (arg == "--image-size") {
+			o.image_size = std::stoul(value());
+			if (o.image_size < 1) {
+				throw std::invalid_argument("--image-size must be at least 1");
+			}
+		} else if (arg == "--idat-split") {
+			o.idat_split = std::stoul(value());
+		} else if (arg == "--texts") {
+			o.texts = std::stoul(value());
+		} else if (arg == "--text-size") {
+			o.text_size = std::stoul(value());
+		} else if (arg == "--compress") {
+			auto kind = value();
+			if (kind == "none") {
+				o.kind = corpus::TextKind::plain;
+			} else if (kind == "ztxt") {
+				o.kind = corpus::TextKind::ztxt;
+			} else if (kind == "itxt") {
+				o.kind = corpus::TextKind::itxt;
+			} else {
+				throw std::invalid_argument("unknown compression: " + kind);
+			}
+		} else if (arg == "--placement") {
+			auto placement = value();
+			if (placement == "before") {
+				o.placement = corpus::Placement::before;
+			} else if (placement == "after") {
+				o.placement = corpus::Placement::after;
+			} else if (placement == "both") {
+				o.placement = corpus::Placement::both;
+			} else {
+				throw std::invalid_argument("unknown placement: " + placement);
+			}
+		} else {
+			throw std::invalid_argument("unknown option: " + arg);
+		}
+		if (arg.rfind("--", 0) == 0 && arg != "--profile" && arg != "--seed" && arg != "--count") {
+			options.overridden.push_back(arg);
+		}
+	}
+	if (options.output_dir.empty()) {
+		throw std::invalid_argument("no output directory");
+	}
+	return options;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+	Options options;
+	try {
+		options = parse_args(argc, argv);
+	} catch (const std::exception& e) {
+		std::fprintf(stderr, "%s\n%s", e.what(), USAGE);
+		return 2;
+	}
+
+	try {
+		fs::create_directories(options.output_dir);
+		for (std::size_t i = 0; i < options.count; i++) {
+			auto rng = corpus::file_rng(options.seed, i);
+			auto profile =
+				options.profile == "mixed" ? corpus::mixed(rng) : corpus::preset(options.profile);
+			apply_overrides(profile, options);
+			auto png = corpus::make_png(rng, profile);
+			char name[64];
+			std::snprintf(name, sizeof(name), "%s_%06zu.png", options.profile.c_str(), i);
+			auto path = options.output_dir / name;
+			std::ofstream ofs(path, std::ios::out | std::ios::binary | std::ios::trunc);
+			ofs.write(png.data(), png.size());
+			if (ofs.fail()) {
+				throw std::runtime_error("failed to write " + path.string());
+			}
+			std::printf("%s\n", path.string().c_str());
+		}
+	} catch (const std::exception& e) {
+		std::fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
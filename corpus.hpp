@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "png_text_chunk.hpp"
+
+// Deterministic synthetic PNGs, shared by png_text_chunk_corpus and the benchmarks: the same
+// seed, file index and profile always produce the same bytes.
+namespace png_text_chunk {
+namespace corpus {
+enum class Placement { before, after, both };
+enum class TextKind { plain, ztxt, itxt };
+
+struct Profile {
+	std::size_t image_size = 256 * 1024;  // approximate size of the raw image data
+	std::size_t idat_split = 64 * 1024;	  // maximum IDAT data size
+	std::size_t texts = 8;
+	std::size_t text_size = 256;
+	TextKind kind = TextKind::plain;
+	Placement placement = Placement::before;
+};
+
+inline Profile preset(const std::string& name) {
+	Profile p;
+	if (name == "tiny_idats") {
+		p.image_size = 1024 * 1024;
+		p.idat_split = 256;
+	} else if (name == "huge_idat") {
+		p.image_size = 100 * 1024 * 1024;
+		p.idat_split = p.image_size + 1024 * 1024;
+	} else if (name == "many_texts") {
+		p.texts = 500;
+		p.text_size = 64;
+		p.placement = Placement::both;
+	} else if (name == "big_itxt") {
+		p.image_size = 16 * 1024;
+		p.texts = 1;
+		p.text_size = 16 * 1024 * 1024;
+		p.kind = TextKind::itxt;
+	} else if (name != "mixed") {
+		throw std::invalid_argument("unknown profile: " + name);
+	}
+	return p;
+}
+
+// Engine output only: the standard distributions are implementation-defined, and the corpus
+// must not depend on the standard library.
+inline std::uint64_t pick(std::mt19937_64& rng, std::uint64_t bound) { return rng() % bound; }
+
+// each file of the mixed profile draws its shape from the seed
+inline Profile mixed(std::mt19937_64& rng) {
+	Profile p;
+	p.image_size = std::size_t(1024) << pick(rng, 15);	// 1 KiB ~ 16 MiB
+	p.idat_split = std::size_t(256) << pick(rng, 12);	// 256 B ~ 512 KiB
+	p.texts = static_cast<std::size_t>(pick(rng, 64));
+	p.text_size = std::size_t(1) << pick(rng, 16);
+	p.kind = static_cast<TextKind>(pick(rng, 3));
+	p.placement = static_cast<Placement>(pick(rng, 3));
+	return p;
+}
+
+inline std::uint32_t adler32(const std::vector<char>& data) {
+	std::uint32_t a = 1, b = 0;
+	for (std::size_t i = 0; i < data.size();) {
+		auto end = std::min(data.size(), i + 5552);
+		for (; i < end; i++) {
+			a += static_cast<unsigned char>(data[i]);
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+// zlib stream of stored deflate blocks: valid image data without depending on zlib
+inline std::vector<char> stored_zlib_stream(const std::vector<char>& raw) {
+	std::vector<char> out = {'\x78', '\x01'};
+	std::size_t pos = 0;
+	do {
+		auto size = std::min<std::size_t>(raw.size() - pos, 65535);
+		bool final = pos + size == raw.size();
+		out.push_back(final ? 1 : 0);
+		out.push_back(static_cast<char>(size & 0xff));
+		out.push_back(static_cast<char>(size >> 8));
+		out.push_back(static_cast<char>(~size & 0xff));
+		out.push_back(static_cast<char>((~size >> 8) & 0xff));
+		out.insert(out.end(), raw.begin() + pos, raw.begin() + pos + size);
+		pos += size;
+	} while (pos < raw.size());
+	auto adler = adler32(raw);
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<char>((adler >> shift) & 0xff));
+	}
+	return out;
+}
+
+inline void append_chunk(std::vector<char>& png, const char* type, const char* data,
+						 std::size_t size) {
+	std::uint32_t length = png_text_chunk::swap_endian(static_cast<std::uint32_t>(size));
+	png.insert(png.end(), reinterpret_cast<char*>(&length), reinterpret_cast<char*>(&length) + 4);
+	auto type_begin = png.size();
+	png.insert(png.end(), type, type + 4);
+	png.insert(png.end(), data, data + size);
+	std::uint32_t crc = png_text_chunk::swap_endian(
+		png_text_chunk::calculate_crc(png.data() + type_begin, png.size() - type_begin));
+	png.insert(png.end(), reinterpret_cast<char*>(&crc), reinterpret_cast<char*>(&crc) + 4);
+}
+
+// words rather than noise, so that compressed texts compress like real metadata
+inline std::string make_text(std::mt19937_64& rng, std::size_t size) {
+	static const char* const words[] = {"exposure", "camera", "lens",	 "iso",	  "white",
+										"balance",	"model",  "author", "orbit", "render",
+										"frame",	"scene",  "light",	"0.25",	 "1920"};
+	std::string text;
+	text.reserve(size + 16);
+	while (text.size() < size) {
+		text += words[pick(rng, sizeof(words) / sizeof(words[0]))];
+		text.push_back(' ');
+	}
+	text.resize(size);
+	return text;
+}
+
+inline std::vector<char> make_png(std::mt19937_64& rng, const Profile& p) {
+	// 8-bit grayscale, one filter byte per row
+	std::uint32_t width = static_cast<std::uint32_t>(std::min<std::size_t>(p.image_size, 4096));
+	std::uint32_t height = static_cast<std::uint32_t>((p.image_size + width - 1) / width);
+	std::vector<char> raw((width + 1ull) * height);
+	for (std::size_t i = 0; i < raw.size(); i += 8) {
+		auto r = rng();
+		std::memcpy(raw.data() + i, &r, std::min<std::size_t>(8, raw.size() - i));
+	}
+	for (std::size_t row = 0; row < height; row++) {
+		raw[row * (width + 1)] = 0;
+	}
+	auto idat = stored_zlib_stream(raw);
+
+	std::vector<std::vector<char>> texts;
+	png_text_chunk::Compression compression;
+	if (p.kind != TextKind::plain) {
+		compression.min_size = 0;
+	}
+	for (std::size_t i = 0; i < p.texts; i++) {
+		texts.push_back(png_text_chunk::generate_text_chunk<char>(
+			"key" + std::to_string(i), make_text(rng, p.text_size), p.kind == TextKind::itxt,
+			compression));
+	}
+	auto before = p.placement == Placement::before ? texts.size()
+				  : p.placement == Placement::after ? 0
+													: texts.size() / 2;
+
+	std::vector<char> png = {'\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n'};
+	unsigned char ihdr[13] = {};
+	std::uint32_t be = png_text_chunk::swap_endian(width);
+	std::memcpy(ihdr, &be, 4);
+	be = png_text_chunk::swap_endian(height);
+	std::memcpy(ihdr + 4, &be, 4);
+	ihdr[8] = 8;  // bit depth; color type, compression, filter and interlace are 0
+	append_chunk(png, "IHDR", reinterpret_cast<char*>(ihdr), sizeof(ihdr));
+	for (std::size_t i = 0; i < before; i++) {
+		png.insert(png.end(), texts[i].begin(), texts[i].end());
+	}
+	auto split = std::max<std::size_t>(p.idat_split, 1);
+	for (std::size_t pos = 0; pos < idat.size(); pos += split) {
+		append_chunk(png, "IDAT", idat.data() + pos, std::min(split, idat.size() - pos));
+	}
+	for (std::size_t i = before; i < texts.size(); i++) {
+		png.insert(png.end(), texts[i].begin(), texts[i].end());
+	}
+	append_chunk(png, "IEND", nullptr, 0);
+	return png;
+}
+
+// one stream per file, so a file does not depend on how many precede it
+inline std::mt19937_64 file_rng(std::uint64_t seed, std::size_t index) {
+	std::seed_seq seq{static_cast<std::uint32_t>(seed), static_cast<std::uint32_t>(seed >> 32),
+					  static_cast<std::uint32_t>(index)};
+	return std::mt19937_64(seq);
+}
+}  // namespace corpus
+}  // namespace png_text_chunk
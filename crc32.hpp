@@ -0,0 +1,196 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include "stats.hpp"
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define PNG_TEXT_CHUNK_CRC32_PCLMUL
+#endif
+
+// CRC-32 (ISO-HDLC / PNG) kernels. Bit-exact with CRC::CRC_32() of CRC.h.
+namespace png_text_chunk {
+namespace crc32_detail {
+constexpr std::uint32_t POLY_REFLECTED = 0xEDB88320;
+
+using SliceTables = std::array<std::array<std::uint32_t, 256>, 8>;
+
+constexpr SliceTables make_slice_tables() {
+	SliceTables t{};
+	for (std::uint32_t i = 0; i < 256; i++) {
+		std::uint32_t c = i;
+		for (int k = 0; k < 8; k++) {
+			c = (c & 1) ? (c >> 1) ^ POLY_REFLECTED : c >> 1;
+		}
+		t[0][i] = c;
+	}
+	for (std::size_t i = 0; i < 256; i++) {
+		for (std::size_t s = 1; s < 8; s++) {
+			t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+		}
+	}
+	return t;
+}
+
+inline constexpr SliceTables slice_tables = make_slice_tables();
+
+inline std::uint32_t load_le32(const unsigned char* p) {
+	return static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) |
+		   (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+// `crc` is the raw (pre-inverted) register value.
+inline std::uint32_t update_slice8(std::uint32_t crc, const unsigned char* p, std::size_t size) {
+	const auto& t = slice_tables;
+	while (size >= 8) {
+		std::uint32_t lo = load_le32(p) ^ crc;
+		std::uint32_t hi = load_le32(p + 4);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			  t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+		p += 8;
+		size -= 8;
+	}
+	while (size--) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+	}
+	return crc;
+}
+
+#ifdef PNG_TEXT_CHUNK_CRC32_PCLMUL
+constexpr std::size_t PCLMUL_MIN_SIZE = 64;
+
+// Carry-less multiplication folding ("Fast CRC Computation for Generic Polynomials Using
+// PCLMULQDQ Instruction", Intel). Requires size >= 64 and a multiple of 16.
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("pclmul,sse4.1")))
+#endif
+inline std::uint32_t update_pclmul(std::uint32_t crc, const unsigned char* buf, std::size_t len) {
+	alignas(16) static const std::uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+	alignas(16) static const std::uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+	alignas(16) static const std::uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+	alignas(16) static const std::uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+	x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+	x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+	x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+	x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+	buf += 64;
+	len -= 64;
+
+	// fold 4 x 128 bits in parallel
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+		y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x00));
+		y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x10));
+		y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x20));
+		y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf + 0x30));
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+		buf += 64;
+		len -= 64;
+	}
+
+	// fold into 128 bits
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+	for (auto next : {x2, x3, x4}) {
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+	}
+	while (len >= 16) {
+		x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+		x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+		buf += 16;
+		len -= 16;
+	}
+
+	// fold 128 bits to 64 bits
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, x3);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// Barrett reduction to 32 bits
+	x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+	x2 = _mm_and_si128(x1, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, x3);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+inline bool cpu_has_pclmul() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	constexpr int SSE41 = 1 << 19, PCLMULQDQ = 1 << 1;
+	return (info[2] & SSE41) && (info[2] & PCLMULQDQ);
+#else
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
+}
+#endif
+
+enum class Kernel { slice8, pclmul };
+
+// Selected once per process from cpuid.
+inline Kernel selected_kernel() {
+#ifdef PNG_TEXT_CHUNK_CRC32_PCLMUL
+	static const Kernel kernel = cpu_has_pclmul() ? Kernel::pclmul : Kernel::slice8;
+	return kernel;
+#else
+	return Kernel::slice8;
+#endif
+}
+
+inline std::uint32_t update(std::uint32_t crc, const unsigned char* p, std::size_t size,
+							Kernel kernel) {
+#ifdef PNG_TEXT_CHUNK_CRC32_PCLMUL
+	if (kernel == Kernel::pclmul && size >= PCLMUL_MIN_SIZE) {
+		std::size_t bulk = size & ~static_cast<std::size_t>(15);
+		crc = update_pclmul(crc, p, bulk);
+		p += bulk;
+		size -= bulk;
+	}
+#else
+	(void)kernel;
+#endif
+	return update_slice8(crc, p, size);
+}
+}  // namespace crc32_detail
+
+// zlib-style running CRC-32: pass the previous result as `crc` to continue a computation.
+inline std::uint32_t calculate_crc(const void* data, std::size_t size, std::uint32_t crc = 0) {
+	PNG_TEXT_CHUNK_STAGE(crc);
+	PNG_TEXT_CHUNK_STAT(crc_bytes, size);
+	return ~crc32_detail::update(~crc, static_cast<const unsigned char*>(data), size,
+								 crc32_detail::selected_kernel());
+}
+}  // namespace png_text_chunk
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+
+namespace png_text_chunk {
+// Failure reasons reported by the try_* functions, which never throw for malformed input.
+enum class Errc {
+	ok = 0,
+	bad_signature,
+	cannot_open,
+	truncated_chunk,
+	crc_mismatch,
+	ihdr_not_found,
+	missing_iend,  // the data ends before an IEND chunk
+	malformed_text,	 // a separator of a text chunk is missing
+	unknown_compression,
+	compressed_text_truncated,
+	compressed_text_broken,
+	text_too_large,	 // decompressed text over max_text_size
+	compression_unsupported,
+	invalid_key,  // keyword not within 1~79 bytes
+	invalid_compression_level,
+	padding_too_large,
+	chunk_too_large,  // a text chunk over the 2^31-1 bytes a PNG chunk can hold
+};
+
+struct Error {
+	Errc code = Errc::ok;
+	std::uint64_t offset = 0;		// offset of the chunk's length field, when it concerns a chunk
+	std::uint32_t chunk_type = 0;	// tag of that chunk, 0 if its header is cut short
+
+	explicit operator bool() const { return code != Errc::ok; }
+};
+
+inline const char* error_message(Errc code) {
+	switch (code) {
+		case Errc::ok:
+			return "ok";
+		case Errc::bad_signature:
+			return "png signature not found";
+		case Errc::cannot_open:
+			return "cannot open a file";
+		case Errc::truncated_chunk:
+			return "chunk is truncated";
+		case Errc::crc_mismatch:
+			return "CRC doesn't match";
+		case Errc::ihdr_not_found:
+			return "IHDR cannot be found";
+		case Errc::missing_iend:
+			return "IEND cannot be found";
+		case Errc::malformed_text:
+			return "null character is not found";
+		case Errc::unknown_compression:
+			return "unknown compression method";
+		case Errc::compressed_text_truncated:
+			return "compressed text is truncated";
+		case Errc::compressed_text_broken:
+			return "compressed text is broken";
+		case Errc::text_too_large:
+			return "decompressed text is too large";
+		case Errc::compression_unsupported:
+			return "compressed text is not supported: built without zlib";
+		case Errc::invalid_key:
+			return "key size must be within 1~79";
+		case Errc::invalid_compression_level:
+			return "compression level must be within 1~9";
+		case Errc::padding_too_large:
+			return "padding is too large";
+		case Errc::chunk_too_large:
+			return "text chunk is too large";
+	}
+	return "unknown error";
+}
+}  // namespace png_text_chunk
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "stats.hpp"
+
+#ifdef _WIN32
+#include <filesystem>
+#include <system_error>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+namespace png_text_chunk {
+#ifndef _WIN32
+namespace file_copy_detail {
+inline void write_all(int fd, const char* data, std::size_t size) {
+	while (size > 0) {
+		ssize_t n = ::write(fd, data, size);
+		PNG_TEXT_CHUNK_STAT(syscalls, 1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error("cannot write a file");
+		}
+		data += n;
+		size -= static_cast<std::size_t>(n);
+	}
+}
+
+// Copies from `src` at `offset` until EOF through a fixed-size buffer.
+inline void copy_buffered(int src, off_t offset, int dst) {
+	std::vector<char> buffer(1 << 20);
+	PNG_TEXT_CHUNK_STAT(allocations, 1);
+	while (true) {
+		ssize_t n = ::pread(src, buffer.data(), buffer.size(), offset);
+		PNG_TEXT_CHUNK_STAT(syscalls, 1);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error("cannot read a file");
+		}
+		if (n == 0) {
+			return;
+		}
+		PNG_TEXT_CHUNK_STAT(bytes_read, n);
+		PNG_TEXT_CHUNK_STAT(bytes_copied, n);
+		write_all(dst, buffer.data(), static_cast<std::size_t>(n));
+		offset += n;
+	}
+}
+
+// Copies in the kernel with copy_file_range, then sendfile. Returns false, with nothing
+// copied, if neither is supported for this pair of files.
+inline bool copy_in_kernel(int src, off_t offset, std::uint64_t size, int dst) {
+#ifdef __linux__
+	bool first = true;
+	while (size > 0) {
+		ssize_t n = ::copy_file_range(src, &offset, dst, nullptr, size, 0);
+		PNG_TEXT_CHUNK_STAT(syscalls, 1);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			if (!first) {
+				throw std::runtime_error("cannot copy a file");
+			}
+			break;
+		}
+		PNG_TEXT_CHUNK_STAT(bytes_copied, n);
+		size -= static_cast<std::uint64_t>(n);
+		first = false;
+	}
+	while (size > 0) {
+		ssize_t n = ::sendfile(dst, src, &offset, size);
+		PNG_TEXT_CHUNK_STAT(syscalls, 1);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			if (!first) {
+				throw std::runtime_error("cannot copy a file");
+			}
+			return false;
+		}
+		PNG_TEXT_CHUNK_STAT(bytes_copied, n);
+		size -= static_cast<std::uint64_t>(n);
+		first = false;
+	}
+	return true;
+#else
+	(void)src, (void)offset, (void)size, (void)dst;
+	return false;
+#endif
+}
+
+// Creates a new file next to `path`, to be renamed over it once written.
+inline int create_temp_file(const std::string& path, std::string& temp_path) {
+	for (int attempt = 0;; attempt++) {
+		temp_path = path + ".tmp" + std::to_string(::getpid()) + "." + std::to_string(attempt);
+		int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		if (fd >= 0 || errno != EEXIST || attempt == 100) {
+			return fd;
+		}
+	}
+}
+}  // namespace file_copy_detail
+#endif
+
+// Writes `head` to `dst_path` followed by the contents of `src_path` from `offset` on, with
+// memory use independent of the file size. The output is written to a temporary file next to
+// `dst_path` and renamed over it once complete, so a failed copy leaves `dst_path` untouched
+// and `dst_path` may be `src_path` itself.
+inline void write_head_and_copy_tail(const std::string& dst_path, const std::vector<char>& head,
+									 const std::string& src_path, std::uint64_t offset) {
+#ifndef _WIN32
+	using namespace file_copy_detail;
+	PNG_TEXT_CHUNK_STAT(syscalls, 8);  // open and close both files, fstat, stat, fchmod, rename
+	int src = ::open(src_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (src < 0) {
+		throw std::runtime_error("cannot open a file");
+	}
+	std::string temp_path;
+	int dst = create_temp_file(dst_path, temp_path);
+	if (dst < 0) {
+		::close(src);
+		throw std::runtime_error("failed to open an output file");
+	}
+	try {
+		struct stat st {};
+		bool regular = ::fstat(src, &st) == 0 && S_ISREG(st.st_mode);
+		// the output keeps the mode of the file it replaces, or takes the source's
+		struct stat old {};
+		if (::stat(dst_path.c_str(), &old) == 0) {
+			::fchmod(dst, old.st_mode & 07777);
+		} else if (regular) {
+			::fchmod(dst, st.st_mode & 0777);
+		}
+		write_all(dst, head.data(), head.size());
+		std::uint64_t src_size = regular ? static_cast<std::uint64_t>(st.st_size) : 0;
+		if (!regular || src_size <= offset ||
+			!copy_in_kernel(src, static_cast<off_t>(offset), src_size - offset, dst)) {
+			copy_buffered(src, static_cast<off_t>(offset), dst);
+		}
+	} catch (...) {
+		::close(src);
+		::close(dst);
+		::unlink(temp_path.c_str());
+		throw;
+	}
+	::close(src);
+	if (::close(dst) != 0 || ::rename(temp_path.c_str(), dst_path.c_str()) != 0) {
+		::unlink(temp_path.c_str());
+		throw std::runtime_error("cannot write a file");
+	}
+#else
+	std::ifstream ifs(src_path, std::ios::in | std::ios::binary);
+	if (ifs.fail()) {
+		throw std::runtime_error("cannot open a file");
+	}
+	auto temp_path = dst_path + ".tmp";
+	std::ofstream ofs(temp_path, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (ofs.fail()) {
+		throw std::runtime_error("failed to open an output file");
+	}
+	ofs.write(head.data(), head.size());
+	ifs.seekg(offset);
+	std::vector<char> buffer(1 << 20);
+	while (ifs.read(buffer.data(), buffer.size()) || ifs.gcount() > 0) {
+		PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+		PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
+		PNG_TEXT_CHUNK_STAT(bytes_copied, ifs.gcount());
+		ofs.write(buffer.data(), ifs.gcount());
+	}
+	ofs.close();
+	ifs.close();
+	std::error_code ec;
+	auto old = std::filesystem::status(dst_path, ec);
+	if (std::filesystem::exists(old)) {
+		std::filesystem::permissions(temp_path, old.permissions(), ec);
+	}
+	if (ofs.fail() || (std::filesystem::rename(temp_path, dst_path, ec), ec)) {
+		std::filesystem::remove(temp_path, ec);
+		throw std::runtime_error("cannot write a file");
+	}
+#endif
+}
+}  // namespace png_text_chunk
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "stats.hpp"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace png_text_chunk {
+// Read-only view of a whole file. Regular files are memory-mapped; pipes, empty files and
+// platforms without mmap fall back to reading the file into an owned buffer.
+class MappedFile {
+   public:
+	explicit MappedFile(const std::string& filename) {
+		if (auto error = open(filename)) {
+			throw std::runtime_error(error);
+		}
+	}
+
+	// Non-throwing: on failure `ec` is set and the view is empty.
+	MappedFile(const std::string& filename, std::error_code& ec) {
+		ec.clear();
+		if (open(filename)) {
+			ec = std::error_code(errno ? errno : EIO, std::generic_category());
+		}
+	}
+
+	~MappedFile() {
+#ifndef _WIN32
+		if (mapped_) {
+			::munmap(const_cast<unsigned char*>(data_), size_);
+		}
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const unsigned char* data() const { return data_; }
+	std::size_t size() const { return size_; }
+	bool mapped() const { return mapped_; }
+
+	// Asks the kernel to read the whole file ahead, for callers that will touch every byte.
+	// Walking the chunk headers only faults in the pages it reads.
+	void will_need() const {
+#ifndef _WIN32
+		if (mapped_) {
+			PNG_TEXT_CHUNK_STAT(syscalls, 2);
+			auto p = const_cast<unsigned char*>(data_);
+			::madvise(p, size_, MADV_SEQUENTIAL);
+			::madvise(p, size_, MADV_WILLNEED);
+		}
+#endif
+	}
+
+   private:
+	// nullptr on success, otherwise the error message
+	const char* open(const std::string& filename) {
+#ifndef _WIN32
+		int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+		PNG_TEXT_CHUNK_STAT(syscalls, 1);
+		if (fd < 0) {
+			return "cannot open a file";
+		}
+		struct stat st {};
+		PNG_TEXT_CHUNK_STAT(syscalls, 2);  // fstat, close
+		if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+			void* p = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE,
+							 fd, 0);
+			PNG_TEXT_CHUNK_STAT(syscalls, 1);
+			if (p != MAP_FAILED) {
+				PNG_TEXT_CHUNK_STAT(bytes_read, st.st_size);
+				data_ = static_cast<const unsigned char*>(p);
+				size_ = static_cast<std::size_t>(st.st_size);
+				mapped_ = true;
+				::close(fd);
+				return nullptr;
+			}
+		}
+		std::array<unsigned char, 1 << 16> chunk;
+		ssize_t n;
+		while ((n = ::read(fd, chunk.data(), chunk.size())) > 0) {
+			PNG_TEXT_CHUNK_STAT(syscalls, 1);
+			PNG_TEXT_CHUNK_STAT(bytes_read, n);
+			PNG_TEXT_CHUNK_STAT(allocations, buffer_.capacity() - buffer_.size() < std::size_t(n));
+			buffer_.insert(buffer_.end(), chunk.data(), chunk.data() + n);
+		}
+		PNG_TEXT_CHUNK_STAT(syscalls, 1);
+		auto read_errno = errno;
+		::close(fd);
+		if (n < 0) {
+			errno = read_errno;
+			buffer_.clear();
+			return "cannot read a file";
+		}
+#else
+		std::ifstream ifs(filename, std::ios::in | std::ios::binary);
+		if (ifs.fail()) {
+			errno = ENOENT;
+			return "cannot open a file";
+		}
+		buffer_.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+		PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+		PNG_TEXT_CHUNK_STAT(bytes_read, buffer_.size());
+		PNG_TEXT_CHUNK_STAT(allocations, !buffer_.empty());
+#endif
+		data_ = buffer_.data();
+		size_ = buffer_.size();
+		return nullptr;
+	}
+
+	const unsigned char* data_ = nullptr;
+	std::size_t size_ = 0;
+	bool mapped_ = false;
+	std::vector<unsigned char> buffer_;
+};
+}  // namespace png_text_chunk
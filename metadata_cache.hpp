@@ -0,0 +1,150 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_index.hpp"
+#include "png_text_chunk.hpp"
+
+namespace png_text_chunk {
+using TextMap = std::unordered_map<std::string, std::string>;
+
+struct CacheStats {
+	std::uint64_t hits = 0;
+	std::uint64_t misses = 0;
+	std::uint64_t evictions = 0;
+	std::size_t entries = 0;
+	std::size_t bytes = 0;
+};
+
+// Thread-safe LRU of extracted text metadata keyed by file identity (device, inode, mtime,
+// size), evicting least recently used files once the charged bytes exceed `byte_budget`.
+// Files hash to independent shards, each with its own lock and an equal share of the budget.
+class MetadataCache {
+   public:
+	explicit MetadataCache(std::size_t byte_budget, std::size_t shards = 16)
+		: shards_(shards == 0 ? 1 : shards) {
+		for (auto& shard : shards_) {
+			shard.budget = byte_budget / shards_.size();
+		}
+	}
+
+	MetadataCache(const MetadataCache&) = delete;
+	MetadataCache& operator=(const MetadataCache&) = delete;
+
+	// Process-wide instance with a 64 MiB budget.
+	static MetadataCache& global() {
+		static MetadataCache cache(64 * 1024 * 1024);
+		return cache;
+	}
+
+	// Returns the text chunks of `filename`, parsing the file only when it is not cached or
+	// has changed since it was cached.
+	std::shared_ptr<const TextMap> get(const std::string& filename) {
+		auto identity = file_identity(filename);
+		Key key{identity.device, identity.inode};
+		auto& shard = shards_[FileKeyHash()(key) % shards_.size()];
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto it = shard.map.find(key);
+			if (it != shard.map.end()) {
+				if (it->second->identity == identity) {
+					shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+					hits_++;
+					return shard.lru.front().texts;
+				}
+				shard.erase(it);
+			}
+		}
+
+		misses_++;
+		auto texts = std::make_shared<const TextMap>(extract_text_chunks(filename));
+		auto cost = charge(*texts);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		if (cost > shard.budget) {
+			return texts;
+		}
+		auto it = shard.map.find(key);
+		if (it != shard.map.end()) {
+			shard.erase(it);
+		}
+		shard.lru.push_front({key, identity, texts, cost});
+		shard.map[key] = shard.lru.begin();
+		shard.bytes += cost;
+		while (shard.bytes > shard.budget) {
+			shard.erase(shard.map.find(shard.lru.back().key));
+			evictions_++;
+		}
+		return texts;
+	}
+
+	void clear() {
+		for (auto& shard : shards_) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.map.clear();
+			shard.lru.clear();
+			shard.bytes = 0;
+		}
+	}
+
+	CacheStats stats() const {
+		CacheStats ret;
+		ret.hits = hits_;
+		ret.misses = misses_;
+		ret.evictions = evictions_;
+		for (auto& shard : shards_) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			ret.entries += shard.lru.size();
+			ret.bytes += shard.bytes;
+		}
+		return ret;
+	}
+
+   private:
+	using Key = FileKey;
+	struct Entry {
+		Key key;
+		FileIdentity identity;
+		std::shared_ptr<const TextMap> texts;
+		std::size_t cost;
+	};
+	struct Shard {
+		mutable std::mutex mutex;
+		std::list<Entry> lru;
+		std::unordered_map<Key, std::list<Entry>::iterator, FileKeyHash> map;
+		std::size_t bytes = 0;
+		std::size_t budget = 0;
+
+		void erase(decltype(map)::iterator it) {
+			bytes -= it->second->cost;
+			lru.erase(it->second);
+			map.erase(it);
+		}
+	};
+
+	// approximate heap footprint of one cached file
+	static std::size_t charge(const TextMap& texts) {
+		std::size_t cost = sizeof(Entry) + sizeof(TextMap) + 64;
+		for (auto& [key, value] : texts) {
+			cost += key.size() + value.size() + 64;
+		}
+		return cost;
+	}
+
+	std::vector<Shard> shards_;
+	std::atomic<std::uint64_t> hits_{0};
+	std::atomic<std::uint64_t> misses_{0};
+	std::atomic<std::uint64_t> evictions_{0};
+};
+
+// extract_text_chunks(filename) served from the process-wide MetadataCache.
+inline std::shared_ptr<const TextMap> extract_text_chunks_cached(const std::string& filename) {
+	return MetadataCache::global().get(filename);
+}
+}  // namespace png_text_chunk
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+#include "png_text_chunk.hpp"
+#include "thread_pool.hpp"
+
+namespace png_text_chunk {
+namespace parallel_detail {
+struct InflateJobs {
+	const std::vector<TextView>* views;
+	std::vector<std::string>* inflated;
+	std::size_t max_text_size;
+	std::vector<std::size_t> indices;  // compressed entries of `views`
+	std::vector<std::exception_ptr> errors;
+	std::atomic<std::size_t> next{0};
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::size_t done = 0;
+
+	// Claims and inflates jobs until none are left. Helpers that start after every job has
+	// been claimed return without touching the caller's data.
+	void run() {
+		while (true) {
+			auto k = next++;
+			if (k >= indices.size()) {
+				return;
+			}
+			auto i = indices[k];
+			try {
+				(*inflated)[i] = inflate_text((*views)[i].value, max_text_size);
+			} catch (...) {
+				errors[k] = std::current_exception();
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			if (++done == indices.size()) {
+				cv.notify_all();
+			}
+		}
+	}
+};
+}  // namespace parallel_detail
+
+// Indexes the text chunks with a zero-copy scan, inflates the compressed ones concurrently on
+// `pool` and merges the results in file order. The calling thread takes part in the work, so
+// this is safe to call from a task running on the same pool.
+inline std::unordered_map<std::string, std::string> extract_text_chunks_parallel(
+	const unsigned char* data, std::size_t size, ThreadPool& pool, bool validity_check = true,
+	std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	auto views = extract_text_chunk_views(data, size, validity_check);
+	std::vector<std::string> inflated(views.size());
+	auto jobs = std::make_shared<parallel_detail::InflateJobs>();
+	jobs->views = &views;
+	jobs->inflated = &inflated;
+	jobs->max_text_size = max_text_size;
+	for (std::size_t i = 0; i < views.size(); i++) {
+		if (views[i].compressed) {
+			jobs->indices.push_back(i);
+		}
+	}
+	jobs->errors.resize(jobs->indices.size());
+
+	if (!jobs->indices.empty()) {
+		auto helpers = std::min(pool.size(), jobs->indices.size() - 1);
+		for (std::size_t i = 0; i < helpers; i++) {
+			pool.submit([jobs] { jobs->run(); });
+		}
+		jobs->run();
+		std::unique_lock<std::mutex> lock(jobs->mutex);
+		jobs->cv.wait(lock, [&] { return jobs->done == jobs->indices.size(); });
+		for (auto& error : jobs->errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+	}
+
+	std::unordered_map<std::string, std::string> ret;
+	for (std::size_t i = 0; i < views.size(); i++) {
+		ret[std::string(views[i].key)] =
+			views[i].compressed ? std::move(inflated[i]) : std::string(views[i].value);
+	}
+	return ret;
+}
+
+inline std::unordered_map<std::string, std::string> extract_text_chunks_parallel(
+	const std::string& filename, ThreadPool& pool, bool validity_check = true,
+	std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	MappedFile file(filename);
+	return extract_text_chunks_parallel(file.data(), file.size(), pool, validity_check,
+										max_text_size);
+}
+}  // namespace png_text_chunk
@@ -2,14 +2,23 @@
 
 #include <algorithm>
 #include <array>
+#include <bitset>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
-#define CRCPP_USE_CPP11
-#include "CRC.h"
+#include "crc32.hpp"
+#include "error.hpp"
+#include "file_copy.hpp"
+#include "mapped_file.hpp"
+#include "stats.hpp"
+#include "zlib_codec.hpp"
 
 namespace png_text_chunk {
 using KV = std::pair<std::string, std::string>;
@@ -44,6 +53,8 @@ inline bool is_valid_png(std::ifstream& ifs) {
 
 	ifs.seekg(0);
 	ifs.read(sig.data(), sig.size());
+	PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+	PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
 	for (size_t i = 0; i < sig.size(); i++) {
 		if (PNG_SIG[i] != sig[i]) {
 			return false;
@@ -64,6 +75,11 @@ bool is_valid_png(const std::vector<T>& img) {
 	return true;
 }
 
+inline bool is_valid_png(const unsigned char* data, std::size_t size) {
+	constexpr auto PNG_SIG = "\x89PNG\r\n\x1a\n";
+	return size >= 8 && std::equal(data, data + 8, reinterpret_cast<const unsigned char*>(PNG_SIG));
+}
+
 template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
 std::uint32_t read_size(typename std::vector<T>::const_iterator& begin) {
 	auto length = swap_endian(begin);
@@ -75,6 +91,8 @@ std::uint32_t read_size(typename std::vector<T>::const_iterator& begin) {
 inline std::uint32_t read_size(std::ifstream& ifs) {
 	std::array<char, 4> length{};
 	ifs.read(length.data(), length.size());
+	PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+	PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
 
 	std::uint32_t ret = swap_endian(length.begin());
 	return ret;
@@ -93,31 +111,11 @@ std::string read_string(typename std::vector<T>::const_iterator& begin, std::uin
 inline std::string read_string(std::ifstream& ifs, std::uint32_t length) {
 	std::string text(4, '\0');
 	ifs.read(text.data(), length);
+	PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+	PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
 	return text;
 }
 
-// assume uncompressed
-template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
-std::pair<std::string, std::string> read_key_value(typename std::vector<T>::const_iterator& begin,
-												   std::uint32_t length) {
-	auto end = begin + length;
-
-	auto first_null = std::find(begin, end, '\0');
-
-	auto begin_r = std::make_reverse_iterator(begin);
-	auto delim_r = std::find(std::make_reverse_iterator(end), begin_r, '\0');
-	if (delim_r == begin_r || first_null == end) {
-		throw("null character is not found");
-	}
-	auto last_null = begin + std::distance(delim_r, begin_r);
-
-	std::string key, value;
-	std::copy(begin, first_null, std::back_inserter(key));
-	std::copy(last_null, end, std::back_inserter(value));
-	begin = end;
-	return {key, value};
-}
-
 template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
 std::string read_chunk_name(typename std::vector<T>::const_iterator& begin) {
 	auto ret = read_string<T>(begin, 4);
@@ -152,49 +150,462 @@ inline void skip_content(std::ifstream& ifs, std::uint32_t length) {
 	ifs.seekg(static_cast<size_t>(length + 4), std::ios_base::cur);
 }
 
-template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
-std::pair<std::string, std::string> read_text_chunk(typename std::vector<T>::const_iterator& begin,
-													std::uint32_t length) {
-	constexpr auto size_type = 4;
-	std::uint32_t crc_calculated =
-		CRC::Calculate(&(*(begin - size_type)), length + size_type, CRC::CRC_32());
-	auto [key, value] = read_key_value<T>(begin, length);
-	std::uint32_t crc = swap_endian(begin);
-	if (crc != crc_calculated) {
-		throw std::runtime_error("CRC doesn't match: from_data: " + std::to_string(crc_calculated) +
-								 ", actual: " + std::to_string(crc));
+// A chunk whose CRC does not match or that is cut short (`name` is empty if its header is).
+// A file that ends without IEND is reported as name "IEND" at the end of the file.
+struct CorruptChunk {
+	std::string name;
+	std::uint64_t offset;  // offset of the chunk's length field from the start of the file
+};
+
+inline std::runtime_error crc_error(const CorruptChunk& chunk) {
+	return std::runtime_error("CRC doesn't match: chunk: " + chunk.name +
+							  ", offset: " + std::to_string(chunk.offset));
+}
+
+// Packs a four-character chunk type into the big-endian tag stored in the file.
+constexpr std::uint32_t chunk_tag(const char (&name)[5]) {
+	return (static_cast<std::uint32_t>(static_cast<unsigned char>(name[0])) << 24) |
+		   (static_cast<std::uint32_t>(static_cast<unsigned char>(name[1])) << 16) |
+		   (static_cast<std::uint32_t>(static_cast<unsigned char>(name[2])) << 8) |
+		   static_cast<std::uint32_t>(static_cast<unsigned char>(name[3]));
+}
+
+namespace tag {
+constexpr auto IHDR = chunk_tag("IHDR");
+constexpr auto IDAT = chunk_tag("IDAT");
+constexpr auto IEND = chunk_tag("IEND");
+constexpr auto tEXt = chunk_tag("tEXt");
+constexpr auto iTXt = chunk_tag("iTXt");
+constexpr auto zTXt = chunk_tag("zTXt");
+// private, safe-to-copy chunk of zeros reserving room for in-place text updates
+constexpr auto ptPd = chunk_tag("ptPd");
+}  // namespace tag
+
+// largest chunk data length the PNG specification allows
+constexpr std::size_t MAX_CHUNK_LENGTH = 0x7fffffff;
+
+// Non-owning view of one chunk inside a contiguous buffer.
+struct ChunkView {
+	std::uint32_t type;
+	const unsigned char* data;
+	std::uint32_t length;
+	std::uint32_t crc;	// stored CRC
+	std::size_t offset;	// offset of the chunk's length field from the start of the buffer
+
+	std::string_view name() const { return {reinterpret_cast<const char*>(data) - 4, 4}; }
+	std::string_view content() const { return {reinterpret_cast<const char*>(data), length}; }
+	// the CRC covers the chunk type and data
+	bool crc_ok() const { return calculate_crc(data - 4, length + 4) == crc; }
+	bool is_text() const { return type == tag::tEXt || type == tag::iTXt || type == tag::zTXt; }
+};
+
+inline void check_crc(const ChunkView& chunk) {
+	if (!chunk.crc_ok()) {
+		throw crc_error({std::string(chunk.name()), chunk.offset});
 	}
-	begin += 4;
-	return {key, value};
 }
 
-inline std::pair<std::string, std::string> read_text_chunk(std::ifstream& ifs,
-														   std::uint32_t length) {
+// Four-character name of a chunk type tag.
+inline std::string chunk_name(std::uint32_t type) {
+	std::string name(4, '\0');
+	for (int i = 0; i < 4; i++) {
+		name[i] = static_cast<char>(type >> (24 - 8 * i));
+	}
+	return name;
+}
+
+// Exception carrying the message the throwing API has always used for `error`.
+inline std::runtime_error to_exception(const Error& error,
+									   std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	switch (error.code) {
+		case Errc::truncated_chunk:
+			return std::runtime_error("chunk is truncated at offset " +
+									  std::to_string(error.offset));
+		case Errc::crc_mismatch:
+			return crc_error({chunk_name(error.chunk_type), error.offset});
+		case Errc::text_too_large:
+			return std::runtime_error("decompressed text exceeds " + std::to_string(max_text_size) +
+									  " bytes");
+		default:
+			return std::runtime_error(error_message(error.code));
+	}
+}
+
+// Reads the chunk at `offset` of the `size` bytes at `data` into `chunk`.
+inline Errc next_chunk(const unsigned char* data, std::size_t size, std::size_t offset,
+					   ChunkView& chunk) {
+	if (offset > size || size - offset < 12) {
+		return Errc::truncated_chunk;
+	}
+	const unsigned char* p = data + offset;
+	std::uint32_t length = swap_endian(p);
+	if (size - offset - 12 < length) {
+		return Errc::truncated_chunk;
+	}
+	chunk = {swap_endian(p + 4), p + 8, length, swap_endian(p + 8 + length), offset};
+	PNG_TEXT_CHUNK_STAT(chunks.of(chunk.type), 1);
+	return Errc::ok;
+}
+
+// Iterates over the chunks of `size` bytes at `data`, starting at `offset` (just after the
+// signature by default). Iteration ends at the end of the buffer; callers stop at IEND.
+class ChunkIterator {
+   public:
+	using iterator_category = std::input_iterator_tag;
+	using value_type = ChunkView;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const ChunkView*;
+	using reference = const ChunkView&;
+
+	ChunkIterator() = default;
+	ChunkIterator(const void* data, std::size_t size, std::size_t offset)
+		: begin_(static_cast<const unsigned char*>(data)), size_(size), next_(offset) {
+		parse();
+	}
+
+	reference operator*() const { return chunk_; }
+	pointer operator->() const { return &chunk_; }
+	ChunkIterator& operator++() {
+		parse();
+		return *this;
+	}
+	// all end iterators are equal; others are equal at the same chunk of the same buffer
+	bool operator==(const ChunkIterator& other) const {
+		return at_end_ == other.at_end_ &&
+			   (at_end_ || (begin_ == other.begin_ && next_ == other.next_));
+	}
+	bool operator!=(const ChunkIterator& other) const { return !(*this == other); }
+
+   private:
+	void parse() {
+		if (next_ >= size_) {
+			at_end_ = true;
+			return;
+		}
+		if (next_chunk(begin_, size_, next_, chunk_) != Errc::ok) {
+			throw to_exception({Errc::truncated_chunk, next_});
+		}
+		next_ += chunk_.length + 12ull;
+		at_end_ = false;
+	}
+
+	const unsigned char* begin_ = nullptr;
+	std::size_t size_ = 0;
+	std::size_t next_ = 0;
+	ChunkView chunk_{};
+	bool at_end_ = true;
+};
+
+class ChunkRange {
+   public:
+	ChunkRange(const void* data, std::size_t size, std::size_t offset = 8)
+		: data_(data), size_(size), offset_(offset) {}
+	template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+	explicit ChunkRange(const std::vector<T>& img, std::size_t offset = 8)
+		: ChunkRange(img.data(), img.size(), offset) {}
+
+	ChunkIterator begin() const { return {data_, size_, offset_}; }
+	ChunkIterator end() const { return {}; }
+
+   private:
+	const void* data_;
+	std::size_t size_;
+	std::size_t offset_;
+};
+
+struct TextFields {
+	std::string_view key;
+	std::string_view text;	// zlib stream if compressed
+	bool compressed;
+};
+
+// Locates the keyword and text of a tEXt, zTXt or iTXt chunk without copying.
+inline Errc try_parse_text_fields(const ChunkView& chunk, TextFields& fields) {
+	auto content = chunk.content();
+	auto key_end = content.find('\0');
+	if (key_end == std::string_view::npos) {
+		return Errc::malformed_text;
+	}
+	fields = {content.substr(0, key_end), content.substr(key_end + 1), false};
+	if (chunk.type == tag::zTXt) {
+		// compression method, text
+		if (fields.text.empty() || fields.text[0] != 0) {
+			return Errc::unknown_compression;
+		}
+		fields.text.remove_prefix(1);
+		fields.compressed = true;
+	} else if (chunk.type == tag::iTXt) {
+		// compression flag, compression method, language tag, translated keyword, text
+		if (fields.text.size() < 2) {
+			return Errc::malformed_text;
+		}
+		fields.compressed = fields.text[0] != 0;
+		if (fields.compressed && fields.text[1] != 0) {
+			return Errc::unknown_compression;
+		}
+		auto language_end = fields.text.find('\0', 2);
+		auto translated_end = language_end == std::string_view::npos
+								  ? std::string_view::npos
+								  : fields.text.find('\0', language_end + 1);
+		if (translated_end == std::string_view::npos) {
+			return Errc::malformed_text;
+		}
+		fields.text.remove_prefix(translated_end + 1);
+	}
+	return Errc::ok;
+}
+
+inline TextFields parse_text_fields(const ChunkView& chunk) {
+	TextFields fields{};
+	auto code = try_parse_text_fields(chunk, fields);
+	if (code != Errc::ok) {
+		throw std::runtime_error(error_message(code));
+	}
+	return fields;
+}
+
+// Keyword and raw text of a text chunk; the text is still compressed for zTXt and
+// compressed iTXt.
+inline std::pair<std::string_view, std::string_view> split_key_value(const ChunkView& chunk) {
+	auto fields = parse_text_fields(chunk);
+	return {fields.key, fields.text};
+}
+
+// Keyword and text of a text chunk, inflating compressed text up to `max_text_size` bytes.
+template <class String>
+Error try_decode_text_chunk(const ChunkView& chunk, std::size_t max_text_size, String& key,
+							String& value) {
+	PNG_TEXT_CHUNK_STAGE(decode);
+	TextFields fields{};
+	auto code = try_parse_text_fields(chunk, fields);
+	if (code == Errc::ok) {
+		key.assign(fields.key);
+		if (fields.compressed) {
+			code = try_inflate_text(fields.text, max_text_size, value);
+		} else {
+			value.assign(fields.text);
+		}
+	}
+	return {code, code == Errc::ok ? 0 : chunk.offset, code == Errc::ok ? 0 : chunk.type};
+}
+
+inline std::pair<std::string, std::string> decode_text_chunk(
+	const ChunkView& chunk, std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	auto fields = parse_text_fields(chunk);
+	if (fields.compressed) {
+		return {std::string(fields.key), inflate_text(fields.text, max_text_size)};
+	}
+	return {std::string(fields.key), std::string(fields.text)};
+}
+
+// Streams the chunk data through `buffer` and checks it against the stored CRC.
+// `name` is the chunk type, which has already been consumed from the stream.
+inline bool verify_content(std::ifstream& ifs, const std::string& name, std::uint32_t length,
+						   std::vector<char>& buffer) {
+	std::uint32_t crc_calculated = calculate_crc(name.data(), name.size());
+	while (length > 0) {
+		auto size = static_cast<std::uint32_t>(std::min<std::size_t>(length, buffer.size()));
+		ifs.read(buffer.data(), size);
+		PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+		PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
+		crc_calculated = calculate_crc(buffer.data(), size, crc_calculated);
+		length -= size;
+	}
+	std::uint32_t crc = read_size(ifs);
+	return !ifs.fail() && crc == crc_calculated;
+}
+
+// Checks the CRC of every chunk up to IEND, reporting the first corrupt or truncated chunk,
+// or missing_iend if the data ends before IEND.
+inline Error try_verify(const unsigned char* data, std::size_t size, bool validity_check = true) {
+	PNG_TEXT_CHUNK_STAGE(scan);
+	if (validity_check && !is_valid_png(data, size)) {
+		return {Errc::bad_signature};
+	}
+	if (size < 8) {
+		return {Errc::truncated_chunk, 0};
+	}
+	ChunkView chunk{};
+	std::size_t offset = 8;
+	for (; offset < size; offset += chunk.length + 12ull) {
+		if (next_chunk(data, size, offset, chunk) != Errc::ok) {
+			// the type is known if the header is complete
+			return {Errc::truncated_chunk, offset,
+					size - offset >= 8 ? swap_endian(data + offset + 4) : 0};
+		}
+		if (!chunk.crc_ok()) {
+			return {Errc::crc_mismatch, offset, chunk.type};
+		}
+		if (chunk.type == tag::IEND) {
+			return {};
+		}
+	}
+	return {Errc::missing_iend, offset};
+}
+
+// Same checks in a single forward pass over a stream with constant memory.
+inline Error try_verify(std::ifstream& ifs, bool validity_check = true) {
+	if (validity_check && !is_valid_png(ifs)) {
+		return {Errc::bad_signature};
+	}
+
+	PNG_TEXT_CHUNK_STAGE(scan);
+	ifs.seekg(0);
+	ifs.ignore(8);
+	PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+	if (ifs.gcount() < 8) {
+		return {Errc::truncated_chunk, 0};
+	}
+	std::vector<char> buffer(1 << 16);
+	PNG_TEXT_CHUNK_STAT(allocations, 1);
+	std::uint64_t offset = 8;
+	while (true) {
+		if (ifs.peek() == std::ifstream::traits_type::eof()) {
+			return {Errc::missing_iend, offset};
+		}
+		auto [name, length] = read_chunk_name_size(ifs);
+		if (!ifs) {
+			return {Errc::truncated_chunk, offset};
+		}
+		auto type = swap_endian(name.begin());
+		PNG_TEXT_CHUNK_STAT(chunks.of(type), 1);
+		if (!verify_content(ifs, name, length, buffer)) {
+			return {ifs.fail() ? Errc::truncated_chunk : Errc::crc_mismatch, offset, type};
+		}
+		if (type == tag::IEND) {
+			return {};
+		}
+		offset += length + 12ull;
+	}
+}
+
+inline Error try_verify(const std::string& filename, bool validity_check = true) {
+	std::error_code ec;
+	MappedFile file(filename, ec);
+	if (ec) {
+		return {Errc::cannot_open};
+	}
+	file.will_need();
+	return try_verify(file.data(), file.size(), validity_check);
+}
+
+// The first corrupt chunk reported by try_verify, nullopt for an intact file. A chunk cut
+// short in its header has an empty name; a missing IEND is reported as "IEND" at the end of
+// the data. Throws if the signature is wrong or the file cannot be opened.
+inline std::optional<CorruptChunk> to_corrupt_chunk(const Error& error) {
+	switch (error.code) {
+		case Errc::ok:
+			return std::nullopt;
+		case Errc::missing_iend:
+			return CorruptChunk{"IEND", error.offset};
+		case Errc::truncated_chunk:
+		case Errc::crc_mismatch:
+			return CorruptChunk{error.chunk_type == 0 ? "" : chunk_name(error.chunk_type),
+								error.offset};
+		default:
+			throw to_exception(error);
+	}
+}
+
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::optional<CorruptChunk> find_corrupt_chunk(const std::vector<T>& img,
+											   bool validity_check = true) {
+	return to_corrupt_chunk(
+		try_verify(reinterpret_cast<const unsigned char*>(img.data()), img.size(), validity_check));
+}
+
+inline std::optional<CorruptChunk> find_corrupt_chunk(std::ifstream& ifs,
+													  bool validity_check = true) {
+	return to_corrupt_chunk(try_verify(ifs, validity_check));
+}
+
+inline std::optional<CorruptChunk> find_corrupt_chunk(const std::string& filename) {
+	return to_corrupt_chunk(try_verify(filename));
+}
+
+// Reads and decodes the text chunk whose data starts at `begin`, just after its type, and
+// advances `begin` past its CRC. zTXt and compressed iTXt are inflated, up to `max_text_size`
+// bytes.
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::pair<std::string, std::string> read_text_chunk(
+	typename std::vector<T>::const_iterator& begin, std::uint32_t length,
+	std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	auto data = reinterpret_cast<const unsigned char*>(&*begin);
+	ChunkView chunk{swap_endian(data - 4), data, length, swap_endian(data + length), 0};
+	check_crc(chunk);
+	begin += length + 4;
+	return decode_text_chunk(chunk, max_text_size);
+}
+
+// Reads and decodes the text chunk whose length and type were just consumed from `ifs`.
+inline std::pair<std::string, std::string> read_text_chunk(
+	std::ifstream& ifs, std::uint32_t length, std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
 	constexpr auto size_type = 4;
 	constexpr auto size_crc = 4;
 
-	std::vector<char> content(length + size_type + size_crc);
-	ifs.read(content.data(), content.size());
-	std::uint32_t crc_calculated =
-		CRC::Calculate(content.data(), content.size() - size_crc, CRC::CRC_32());
+	// the chunk type has already been consumed by read_chunk_name_size
+	ifs.seekg(-size_type, std::ios_base::cur);
+	std::vector<unsigned char> content(size_type + length + size_crc);
+	ifs.read(reinterpret_cast<char*>(content.data()), content.size());
+	PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+	PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
+	if (!ifs) {
+		throw std::runtime_error(error_message(Errc::truncated_chunk));
+	}
+	ChunkView chunk{swap_endian(content.data()), content.data() + size_type, length,
+					swap_endian(content.data() + size_type + length), 0};
+	check_crc(chunk);
+	return decode_text_chunk(chunk, max_text_size);
+}
 
-	auto it = (content.end() - size_crc);
-	auto crc = swap_endian(it);
+// As above, with the content buffer and the strings allocated from `resource`.
+inline std::pair<std::pmr::string, std::pmr::string> read_text_chunk(
+	std::ifstream& ifs, std::uint32_t length, std::pmr::memory_resource* resource,
+	std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	constexpr auto size_type = 4;
+	constexpr auto size_crc = 4;
 
-	if (crc != crc_calculated) {
-		throw std::runtime_error("CRC doesn't match: from_data: " + std::to_string(crc_calculated) +
-								 ", actual: " + std::to_string(crc));
+	ifs.seekg(-size_type, std::ios_base::cur);
+	std::pmr::vector<unsigned char> content(size_type + length + size_crc, resource);
+	ifs.read(reinterpret_cast<char*>(content.data()), content.size());
+	PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+	PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
+	if (!ifs) {
+		throw std::runtime_error(error_message(Errc::truncated_chunk));
+	}
+	ChunkView chunk{swap_endian(content.data()), content.data() + size_type, length,
+					swap_endian(content.data() + size_type + length), 0};
+	check_crc(chunk);
+	std::pmr::string key(resource), value(resource);
+	if (auto error = try_decode_text_chunk(chunk, max_text_size, key, value)) {
+		throw to_exception(error, max_text_size);
 	}
+	return {std::move(key), std::move(value)};
+}
+
+// Compress values of at least `min_size` bytes at `level` (1~9). Disabled by default.
+struct Compression {
+	std::size_t min_size = static_cast<std::size_t>(-1);
+	int level = 6;
 
-	auto begin = content.cbegin() + size_type;
-	auto [key, value] = read_key_value<char>(begin, length);
+	bool applies(std::size_t size) const { return size >= min_size; }
+};
 
-	return {key, value};
+// `text` is the value as stored: already deflated when `compressed` is set.
+inline std::size_t text_chunk_size(const std::string& key_ascii, std::string_view text,
+								   bool utf8 = false, bool compressed = false) {
+	constexpr auto size_length = 4;
+	constexpr auto size_type = 4;
+	constexpr auto size_crc = 4;
+	std::size_t size_header = utf8 ? 4 : (compressed ? 1 : 0);
+	return size_length + size_type + key_ascii.size() + 1 + size_header + text.size() + size_crc;
 }
 
+// Writes a complete chunk of text_chunk_size() bytes to `out` and returns the end: tEXt or
+// zTXt (compressed) for Latin-1, iTXt for UTF-8.
 template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
-std::vector<T> generate_text_chunk(const std::string& key_ascii, const std::string& val_ascii,
-								   bool utf8 = false) {
+T* write_text_chunk(T* out, const std::string& key_ascii, std::string_view text,
+					bool utf8 = false, bool compressed = false) {
 	constexpr auto size_length = 4;
 	constexpr auto size_type = 4;
 	constexpr auto size_crc = 4;
@@ -202,46 +613,43 @@ std::vector<T> generate_text_chunk(const std::string& key_ascii, const std::stri
 	if (key_ascii.size() == 0 || key_ascii.size() >= 80) {
 		throw std::runtime_error("key size must be within 1~79");
 	}
-	std::uint32_t length = static_cast<uint32_t>(key_ascii.size() + 1 + val_ascii.size());
-	if (utf8) {
-		length += 4;
-	}
+	std::uint32_t length = static_cast<std::uint32_t>(
+		text_chunk_size(key_ascii, text, utf8, compressed) - size_length - size_type - size_crc);
 	std::uint32_t length_swapped = swap_endian(length);
+	std::memcpy(out, &length_swapped, size_length);
 
-	std::vector<T> ret;
-	ret.reserve(length + size_length + size_type + size_crc);
-	T* len = reinterpret_cast<T*>(&length_swapped);
-	for (int i = 0; i < 4; i++) {
-		ret.push_back(len[i]);
-	}
-	constexpr std::array<T, 4> type_text = {'t', 'E', 'X', 't'};
-	constexpr std::array<T, 4> type_itext = {'i', 'T', 'X', 't'};
-
-	std::vector<T> content;
-	content.reserve(length + size_type);
+	T* content = out + size_length;
+	T* p = content;
+	std::memcpy(p, utf8 ? "iTXt" : (compressed ? "zTXt" : "tEXt"), size_type);
+	p += size_type;
+	p = std::copy(key_ascii.begin(), key_ascii.end(), p);
+	*p++ = '\0';  // sep
 	if (utf8) {
-		std::move(type_itext.begin(), type_itext.end(), std::back_inserter(content));
-
-	} else {
-		std::move(type_text.begin(), type_text.end(), std::back_inserter(content));
+		*p++ = compressed ? 1 : 0;	// compresion flag
+		*p++ = '\0';				// compresson type
+		*p++ = '\0';				// sep
+		*p++ = '\0';				// sep
+	} else if (compressed) {
+		*p++ = '\0';  // compresson type
 	}
-	std::copy(key_ascii.begin(), key_ascii.end(), std::back_inserter(content));
-	content.push_back('\0');  // sep
-	if (utf8) {
-		content.push_back('\0');  // compresion flag
-		content.push_back('\0');  // compresson type
-		content.push_back('\0');  // sep
-		content.push_back('\0');  // sep
-	}
-	std::copy(val_ascii.begin(), val_ascii.end(), std::back_inserter(content));
+	p = std::copy(text.begin(), text.end(), p);
 
-	std::uint32_t crc = CRC::Calculate(content.data(), content.size(), CRC::CRC_32());
-	std::uint32_t crc_swapped = swap_endian(crc);
-	T* crc_ = reinterpret_cast<T*>(&crc_swapped);
-	std::move(content.begin(), content.end(), std::back_inserter(ret));
-	for (int i = 0; i < 4; i++) {
-		ret.push_back(crc_[i]);
+	std::uint32_t crc_swapped = swap_endian(calculate_crc(content, p - content));
+	std::memcpy(p, &crc_swapped, size_crc);
+	return p + size_crc;
+}
+
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::vector<T> generate_text_chunk(const std::string& key_ascii, const std::string& val_ascii,
+								   bool utf8 = false, const Compression& compression = {}) {
+	if (compression.applies(val_ascii.size())) {
+		auto deflated = deflate_text(val_ascii, compression.level);
+		std::vector<T> ret(text_chunk_size(key_ascii, deflated, utf8, true));
+		write_text_chunk(ret.data(), key_ascii, deflated, utf8, true);
+		return ret;
 	}
+	std::vector<T> ret(text_chunk_size(key_ascii, val_ascii, utf8));
+	write_text_chunk(ret.data(), key_ascii, val_ascii, utf8);
 	return ret;
 }
 
@@ -256,27 +664,200 @@ void insert_text_chunk(std::vector<T>& img, typename std::vector<T>::const_itera
 	begin += size;
 }
 
+// offset just past the IHDR chunk, where new text chunks are inserted
+inline Error try_find_insert_position(const unsigned char* data, std::size_t size,
+									  std::size_t& position) {
+	PNG_TEXT_CHUNK_STAGE(scan);
+	ChunkView chunk{};
+	for (std::size_t offset = 8; offset < size; offset += chunk.length + 12ull) {
+		if (next_chunk(data, size, offset, chunk) != Errc::ok) {
+			return {Errc::truncated_chunk, offset};
+		}
+		if (chunk.type == tag::IHDR) {
+			position = offset + chunk.length + 12;
+			return {};
+		}
+	}
+	return {Errc::ihdr_not_found};
+}
+
+inline std::size_t find_insert_position(const unsigned char* data, std::size_t size) {
+	std::size_t position = 0;
+	if (auto error = try_find_insert_position(data, size, position)) {
+		throw to_exception(error);
+	}
+	return position;
+}
+
+// Deflated values for the entries of `kvs` that `compression` applies to, nullopt for the
+// others; empty when compression is disabled.
+using CompressedValues = std::vector<std::optional<std::string>>;
+
+inline CompressedValues compress_values(const std::vector<KV>& kvs,
+										const Compression& compression) {
+	CompressedValues ret;
+	for (std::size_t i = 0; i < kvs.size(); i++) {
+		if (compression.applies(kvs[i].second.size())) {
+			ret.resize(kvs.size());
+			ret[i] = deflate_text(kvs[i].second, compression.level);
+		}
+	}
+	return ret;
+}
+
+inline std::size_t text_chunks_size(const std::vector<KV>& kvs, bool utf8,
+									const CompressedValues& compressed = {}) {
+	std::size_t size = 0;
+	for (std::size_t i = 0; i < kvs.size(); i++) {
+		if (i < compressed.size() && compressed[i]) {
+			size += text_chunk_size(kvs[i].first, *compressed[i], utf8, true);
+		} else {
+			size += text_chunk_size(kvs[i].first, kvs[i].second, utf8);
+		}
+	}
+	return size;
+}
+
 template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
-std::vector<T> insert_text_chunks(std::vector<T>& img_data, const std::vector<KV>& kvs,
-								  bool utf8 = false, bool validity_check = true) {
-	if (validity_check && !is_valid_png(img_data)) {
+T* write_text_chunks(T* out, const std::vector<KV>& kvs, bool utf8,
+					 const CompressedValues& compressed = {}) {
+	for (std::size_t i = 0; i < kvs.size(); i++) {
+		auto& [k, v] = kvs[i];
+		if (i < compressed.size() && compressed[i]) {
+			out = write_text_chunk(out, k, *compressed[i], utf8, true);
+		} else {
+			out = write_text_chunk(out, k, v, utf8);
+		}
+		// std::cout << "insert: key: " << k << ", value: " << v << std::endl;
+	}
+	return out;
+}
+
+// Size of a ptPd chunk with `padding` data bytes; 0 when no padding is reserved.
+inline std::size_t padding_chunk_size(std::size_t padding) {
+	return padding == 0 ? 0 : 12 + padding;
+}
+
+// Writes a ptPd chunk of `padding` zero bytes and returns the end.
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+T* write_padding_chunk(T* out, std::size_t padding) {
+	if (padding > MAX_CHUNK_LENGTH) {
+		throw std::runtime_error(error_message(Errc::padding_too_large));
+	}
+	std::uint32_t length_swapped = swap_endian(static_cast<std::uint32_t>(padding));
+	std::memcpy(out, &length_swapped, 4);
+	T* content = out + 4;
+	std::memcpy(content, "ptPd", 4);
+	std::fill(content + 4, content + 4 + padding, T(0));
+	std::uint32_t crc_swapped = swap_endian(calculate_crc(content, 4 + padding));
+	std::memcpy(content + 4 + padding, &crc_swapped, 4);
+	return content + 4 + padding + 4;
+}
+
+// Inserts in place: one resize and one move of the bytes after IHDR, whatever the number
+// of chunks. `padding` reserves a ptPd chunk of that many bytes after the text chunks for
+// later in-place updates.
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+void insert_text_chunks_in_place(std::vector<T>& img_data, const std::vector<KV>& kvs,
+								 bool utf8 = false, bool validity_check = true,
+								 const Compression& compression = {}, std::size_t padding = 0) {
+	auto data = reinterpret_cast<const unsigned char*>(img_data.data());
+	if (validity_check && !is_valid_png(data, img_data.size())) {
 		throw std::runtime_error("png signature not found");
 	}
 
-	auto begin = img_data.cbegin() + 8;
-	while (begin != img_data.end()) {
-		auto [name, length] = read_chunk_name_size<T>(begin);
-		// std::cout << "chunk: " << name << ", len: " << length << std::endl;
-		if (name == "IHDR") {
-			skip_content<T>(begin, length);
-			for (auto& [k, v] : kvs) {
-				insert_text_chunk(img_data, begin, k, v, utf8);
-				// std::cout << "insert: key: " << k << ", value: " << v << std::endl;
+	auto pos = find_insert_position(data, img_data.size());
+	auto compressed = compress_values(kvs, compression);
+	PNG_TEXT_CHUNK_STAGE(write);
+	auto old_size = img_data.size();
+	auto new_size = old_size + text_chunks_size(kvs, utf8, compressed) + padding_chunk_size(padding);
+	PNG_TEXT_CHUNK_STAT(allocations, img_data.capacity() < new_size);
+	PNG_TEXT_CHUNK_STAT(bytes_copied, old_size - pos);
+	img_data.resize(new_size);
+	std::copy_backward(img_data.begin() + pos, img_data.begin() + old_size, img_data.end());
+	auto out = write_text_chunks(img_data.data() + pos, kvs, utf8, compressed);
+	if (padding > 0) {
+		write_padding_chunk(out, padding);
+	}
+}
+
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::vector<T> insert_text_chunks(std::vector<T>& img_data, const std::vector<KV>& kvs,
+								  bool utf8 = false, bool validity_check = true,
+								  const Compression& compression = {}, std::size_t padding = 0) {
+	insert_text_chunks_in_place(img_data, kvs, utf8, validity_check, compression, padding);
+	return img_data;
+}
+
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::vector<T> insert_text_chunks(std::vector<T>&& img_data, const std::vector<KV>& kvs,
+								  bool utf8 = false, bool validity_check = true,
+								  const Compression& compression = {}, std::size_t padding = 0) {
+	insert_text_chunks_in_place(img_data, kvs, utf8, validity_check, compression, padding);
+	return std::move(img_data);
+}
+
+// Non-throwing insert into `out`, built as a single buffer sized up front. Malformed input
+// and invalid arguments are reported as an Error; only allocation failure throws.
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+Error try_insert_text_chunks(const unsigned char* data, std::size_t size,
+							 const std::vector<KV>& kvs, std::vector<T>& out, bool utf8 = false,
+							 bool validity_check = true, const Compression& compression = {},
+							 std::size_t padding = 0) {
+	if (validity_check && !is_valid_png(data, size)) {
+		return {Errc::bad_signature};
+	}
+	if (padding > MAX_CHUNK_LENGTH) {
+		return {Errc::padding_too_large};
+	}
+	for (auto& kv : kvs) {
+		if (kv.first.size() == 0 || kv.first.size() >= 80) {
+			return {Errc::invalid_key};
+		}
+		if (kv.second.size() > MAX_CHUNK_LENGTH - 128) {  // room for keyword and iTXt fields
+			return {Errc::chunk_too_large};
+		}
+		if (compression.applies(kv.second.size())) {
+#ifdef PNG_TEXT_CHUNK_USE_ZLIB
+			if (compression.level < 1 || compression.level > 9) {
+				return {Errc::invalid_compression_level};
 			}
-			return img_data;
+#else
+			return {Errc::compression_unsupported};
+#endif
 		}
 	}
-	throw std::runtime_error("IHDR cannot be found");
+
+	std::size_t pos = 0;
+	if (auto error = try_find_insert_position(data, size, pos)) {
+		return error;
+	}
+	auto compressed = compress_values(kvs, compression);
+	PNG_TEXT_CHUNK_STAGE(write);
+	auto new_size = size + text_chunks_size(kvs, utf8, compressed) + padding_chunk_size(padding);
+	PNG_TEXT_CHUNK_STAT(allocations, out.capacity() < new_size);
+	PNG_TEXT_CHUNK_STAT(bytes_copied, size);
+	out.resize(new_size);
+	auto p = std::copy(data, data + pos, out.data());
+	p = write_text_chunks(p, kvs, utf8, compressed);
+	if (padding > 0) {
+		p = write_padding_chunk(p, padding);
+	}
+	std::copy(data + pos, data + size, p);
+	return {};
+}
+
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::vector<T> insert_text_chunks(const unsigned char* data, std::size_t size,
+								  const std::vector<KV>& kvs, bool utf8 = false,
+								  bool validity_check = true,
+								  const Compression& compression = {}, std::size_t padding = 0) {
+	std::vector<T> ret;
+	if (auto error = try_insert_text_chunks(data, size, kvs, ret, utf8, validity_check,
+											compression, padding)) {
+		throw to_exception(error);
+	}
+	return ret;
 }
 
 template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
@@ -291,74 +872,578 @@ std::vector<T> insert_text_chunks(std::ifstream& ifs, const std::vector<KV>& kvs
 	ifs.seekg(0);
 	std::vector<T> img_data(img_size);
 	ifs.read(reinterpret_cast<char*>(img_data.data()), img_size);
+	PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+	PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
 	// std::cout << "size = " << img_size << "\n";
-	return insert_text_chunks<T>(img_data, kvs, utf8, false);
+	return insert_text_chunks<T>(std::move(img_data), kvs, utf8, false);
 }
 
 template <typename T = char, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
 std::vector<T> insert_text_chunks(const std::string& filename, const std::vector<KV>& kvs) {
-	std::ifstream ifs;
-	ifs.open(filename, std::ios::out | std::ios::binary);
-	if (ifs.fail()) {
-		throw std::runtime_error("cannot open a file");
-	}
-	return insert_text_chunks<T>(ifs, kvs);
+	MappedFile file(filename);
+	file.will_need();
+	return insert_text_chunks<T>(file.data(), file.size(), kvs);
 }
 
-std::unordered_map<std::string, std::string> extract_text_chunks(const std::string& filename,
-																 bool validity_check = true) {
+// Inserts text chunks from file to file without loading the image: the chunks up to IHDR
+// are read, and everything after them is copied through with constant memory. `dst_path` is
+// replaced only once fully written, so it may be `src_path`.
+inline void insert_text_chunks_stream(const std::string& src_path, const std::string& dst_path,
+									  const std::vector<KV>& kvs, bool utf8 = false,
+									  bool validity_check = true,
+									  const Compression& compression = {},
+									  std::size_t padding = 0) {
 	std::ifstream ifs;
-	ifs.open(filename, std::ios::out | std::ios::binary);
+	ifs.open(src_path, std::ios::in | std::ios::binary);
 	if (ifs.fail()) {
 		throw std::runtime_error("cannot open a file");
 	}
 	if (validity_check && !is_valid_png(ifs)) {
 		throw std::runtime_error("png signature not found");
-	};
+	}
+
+	std::uint64_t pos = 8;
+	ifs.seekg(pos);
+	while (true) {
+		auto [name, length] = read_chunk_name_size(ifs);
+		if (!ifs) {
+			throw std::runtime_error("IHDR cannot be found");
+		}
+		PNG_TEXT_CHUNK_STAT(chunks.of(swap_endian(name.begin())), 1);
+		pos += length + 12ull;
+		if (name == "IHDR") {
+			break;
+		}
+		skip_content(ifs, length);
+	}
+
+	auto compressed = compress_values(kvs, compression);
+	PNG_TEXT_CHUNK_STAGE(write);
+	std::vector<char> head(pos + text_chunks_size(kvs, utf8, compressed) +
+						   padding_chunk_size(padding));
+	PNG_TEXT_CHUNK_STAT(allocations, 1);
+	ifs.seekg(0);
+	ifs.read(head.data(), pos);
+	PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+	PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
+	if (!ifs) {
+		throw std::runtime_error("IHDR is truncated");
+	}
+	ifs.close();
+	auto out = write_text_chunks(head.data() + pos, kvs, utf8, compressed);
+	if (padding > 0) {
+		write_padding_chunk(out, padding);
+	}
+	write_head_and_copy_tail(dst_path, head, src_path, pos);
+}
+
+// Non-throwing extraction into `out`: malformed input is reported as an Error with the
+// offset of the offending chunk. `Map` is std::unordered_map or PmrTextMap; keys and values
+// are allocated with the map's allocator.
+// verify_all: also check the CRC of non-text chunks, not only of text chunks
+// max_text_size: limit for each decompressed zTXt/iTXt text
+template <class Map>
+Error try_extract_text_chunks(const unsigned char* data, std::size_t size, Map& out,
+							  bool validity_check = true, bool verify_all = false,
+							  std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	PNG_TEXT_CHUNK_STAGE(scan);
+	if (validity_check && !is_valid_png(data, size)) {
+		return {Errc::bad_signature};
+	}
 
+	ChunkView chunk{};
+	typename Map::key_type key(out.get_allocator());
+	typename Map::mapped_type value(out.get_allocator());
+	for (std::size_t offset = 8; offset < size; offset += chunk.length + 12ull) {
+		if (next_chunk(data, size, offset, chunk) != Errc::ok) {
+			return {Errc::truncated_chunk, offset};
+		}
+		if ((verify_all || chunk.is_text()) && !chunk.crc_ok()) {
+			return {Errc::crc_mismatch, offset, chunk.type};
+		}
+		if (chunk.is_text()) {
+			if (auto error = try_decode_text_chunk(chunk, max_text_size, key, value)) {
+				return error;
+			}
+			// a map node, plus the strings that do not fit inline
+			PNG_TEXT_CHUNK_STAT(allocations, 1 + stats_detail::heap_strings(key, value));
+			out[std::move(key)] = std::move(value);
+		} else if (chunk.type == tag::IEND) {
+			break;
+		}
+	}
+	return {};
+}
+
+inline std::unordered_map<std::string, std::string> extract_text_chunks(
+	const unsigned char* data, std::size_t size, bool validity_check = true,
+	bool verify_all = false, std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
 	std::unordered_map<std::string, std::string> ret;
+	if (auto error =
+			try_extract_text_chunks(data, size, ret, validity_check, verify_all, max_text_size)) {
+		throw to_exception(error, max_text_size);
+	}
+	return ret;
+}
 
-	ifs.seekg(8);
-	while (!ifs.eof()) {
-		auto [name, length] = read_chunk_name_size(ifs);
-		// std::cout << "chunk: " << name << ", len: " << length << std::endl;
-		if (name == "tEXt" || name == "iTXt") {
-			auto [key, value] = read_text_chunk(ifs, length);
-			// std::cout << " - key: " << key << ", value: " << value << std::endl;
+template <class Map>
+Error try_extract_text_chunks(const std::string& filename, Map& out, bool validity_check = true,
+							  bool verify_all = false,
+							  std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	std::error_code ec;
+	MappedFile file(filename, ec);
+	if (ec) {
+		return {Errc::cannot_open};
+	}
+	if (verify_all) {
+		file.will_need();
+	}
+	return try_extract_text_chunks(file.data(), file.size(), out, validity_check, verify_all,
+								   max_text_size);
+}
+
+inline std::unordered_map<std::string, std::string> extract_text_chunks(
+	const std::string& filename, bool validity_check = true, bool verify_all = false,
+	std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	MappedFile file(filename);
+	if (verify_all) {
+		file.will_need();
+	}
+	return extract_text_chunks(file.data(), file.size(), validity_check, verify_all,
+							   max_text_size);
+}
+
+using PmrTextMap = std::pmr::unordered_map<std::pmr::string, std::pmr::string>;
+
+// Allocates the map, its buckets and nodes, every key and value, and zlib's inflate state
+// and window from `resource`, e.g. a std::pmr::monotonic_buffer_resource per file or per batch
+// that is released in one step. The result must not outlive `resource`.
+inline PmrTextMap extract_text_chunks(const unsigned char* data, std::size_t size,
+									  std::pmr::memory_resource* resource,
+									  bool validity_check = true, bool verify_all = false,
+									  std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	PmrTextMap ret(resource);
+	if (auto error =
+			try_extract_text_chunks(data, size, ret, validity_check, verify_all, max_text_size)) {
+		throw to_exception(error, max_text_size);
+	}
+	return ret;
+}
+
+inline PmrTextMap extract_text_chunks(const std::string& filename,
+									  std::pmr::memory_resource* resource,
+									  bool validity_check = true, bool verify_all = false,
+									  std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	MappedFile file(filename);
+	if (verify_all) {
+		file.will_need();
+	}
+	return extract_text_chunks(file.data(), file.size(), resource, validity_check, verify_all,
+							   max_text_size);
+}
+
+template <typename T = char, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::unordered_map<std::string, std::string> extract_text_chunks(const std::vector<T>& img,
+																 bool validity_check = true,
+																 bool verify_all = false,
+																 std::size_t max_text_size =
+																	 DEFAULT_MAX_TEXT_SIZE) {
+	return extract_text_chunks(reinterpret_cast<const unsigned char*>(img.data()), img.size(),
+							   validity_check, verify_all, max_text_size);
+}
+
+// Keywords to look up; rejects most non-matching keywords by length alone.
+class KeySet {
+   public:
+	KeySet(std::initializer_list<std::string> keys) : KeySet(std::vector<std::string>(keys)) {}
+	explicit KeySet(std::vector<std::string> keys) : keys_(std::move(keys)) {
+		for (auto& key : keys_) {
+			if (key.size() < lengths_.size()) {
+				lengths_.set(key.size());
+			}
+		}
+	}
+
+	bool contains(std::string_view key) const {
+		if (key.size() >= lengths_.size() || !lengths_.test(key.size())) {
+			return false;
+		}
+		return std::find(keys_.begin(), keys_.end(), key) != keys_.end();
+	}
+
+   private:
+	std::vector<std::string> keys_;
+	std::bitset<80> lengths_;  // keywords are 1~79 bytes
+};
+
+// Keyword of a text chunk: the bytes up to the first NUL, looked for within the first 80.
+inline std::string_view text_chunk_keyword(const ChunkView& chunk) {
+	auto size = std::min<std::size_t>(chunk.length, 80);
+	auto null = static_cast<const unsigned char*>(std::memchr(chunk.data, 0, size));
+	return {reinterpret_cast<const char*>(chunk.data),
+			null ? static_cast<std::size_t>(null - chunk.data) : size};
+}
+
+// Extracts only the text chunks whose keyword is in `keys`. Other text chunks are skipped
+// before any CRC, copy or decompression work. verify_crc: check the CRC of matching chunks.
+inline std::unordered_map<std::string, std::string> extract_selected_text_chunks(
+	const unsigned char* data, std::size_t size, const KeySet& keys, bool verify_crc = true,
+	bool validity_check = true, std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	if (validity_check && !is_valid_png(data, size)) {
+		throw std::runtime_error("png signature not found");
+	}
+
+	std::unordered_map<std::string, std::string> ret;
+	for (auto& chunk : ChunkRange(data, size)) {
+		if (chunk.is_text() && keys.contains(text_chunk_keyword(chunk))) {
+			if (verify_crc) {
+				check_crc(chunk);
+			}
+			auto [key, value] = decode_text_chunk(chunk, max_text_size);
 			ret[std::move(key)] = std::move(value);
-		} else if (name == "IEND") {
+		} else if (chunk.type == tag::IEND) {
+			break;
+		}
+	}
+	return ret;
+}
+
+inline std::unordered_map<std::string, std::string> extract_selected_text_chunks(
+	const std::string& filename, const KeySet& keys, bool verify_crc = true,
+	bool validity_check = true, std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	MappedFile file(filename);
+	return extract_selected_text_chunks(file.data(), file.size(), keys, verify_crc,
+										validity_check, max_text_size);
+}
+
+template <typename T = char, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::unordered_map<std::string, std::string> extract_selected_text_chunks(
+	const std::vector<T>& img, const KeySet& keys, bool verify_crc = true,
+	bool validity_check = true, std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	return extract_selected_text_chunks(reinterpret_cast<const unsigned char*>(img.data()),
+										img.size(), keys, verify_crc, validity_check,
+										max_text_size);
+}
+
+struct TextUpdate {
+	std::vector<KV> set;			  // added, or replacing the text chunks with the same keyword
+	std::vector<std::string> remove;  // keywords whose text chunks are dropped
+};
+
+// Output of a text update: source ranges [begin, end) to copy, or entries `kv` of
+// TextUpdate::set to write.
+struct UpdatePlan {
+	static constexpr auto npos = static_cast<std::size_t>(-1);
+	struct Piece {
+		std::size_t begin, end, kv;
+	};
+	std::vector<Piece> pieces;
+	std::vector<bool> placed;		 // set entries written, or superseded by a later one
+	std::size_t insert_at = npos;	 // piece index just after IHDR
+
+	// Adds the set entries that found no chunk to replace at piece index `at`.
+	void add_unplaced(std::size_t at) {
+		std::vector<Piece> added;
+		for (std::size_t i = 0; i < placed.size(); i++) {
+			if (!placed[i]) {
+				added.push_back({0, 0, i});
+				placed[i] = true;
+			}
+		}
+		pieces.insert(pieces.begin() + at, added.begin(), added.end());
+	}
+};
+
+// Plans `update` over the chunks of [data + offset, data + size). A set entry takes the place
+// of the first text chunk with its keyword and later chunks with that keyword are dropped, as
+// are those whose keyword is in `remove`. Of set entries with the same keyword the last wins.
+inline UpdatePlan plan_text_update(const unsigned char* data, std::size_t size,
+								   std::size_t offset, const TextUpdate& update) {
+	constexpr auto npos = UpdatePlan::npos;
+	std::vector<std::string> keys = update.remove;
+	for (auto& kv : update.set) {
+		keys.push_back(kv.first);
+	}
+	KeySet touched(std::move(keys));
+
+	UpdatePlan plan;
+	plan.placed.resize(update.set.size());
+	for (std::size_t i = 0; i < update.set.size(); i++) {
+		for (std::size_t j = i + 1; j < update.set.size() && !plan.placed[i]; j++) {
+			plan.placed[i] = update.set[i].first == update.set[j].first;
+		}
+	}
+	std::size_t copied = 0;
+	for (auto& chunk : ChunkRange(data, size, offset)) {
+		auto end = chunk.offset + chunk.length + 12;
+		if (chunk.type == tag::IHDR && plan.insert_at == npos) {
+			plan.pieces.push_back({copied, end, npos});
+			copied = end;
+			plan.insert_at = plan.pieces.size();
+		} else if (chunk.is_text() && touched.contains(text_chunk_keyword(chunk))) {
+			plan.pieces.push_back({copied, chunk.offset, npos});
+			copied = end;
+			auto key = text_chunk_keyword(chunk);
+			for (std::size_t i = update.set.size(); i-- > 0;) {
+				if (update.set[i].first == key) {
+					if (!plan.placed[i]) {
+						plan.pieces.push_back({0, 0, i});
+						plan.placed[i] = true;
+					}
+					break;
+				}
+			}
+		} else if (chunk.type == tag::IEND) {
 			break;
+		}
+	}
+	plan.pieces.push_back({copied, size, npos});
+	return plan;
+}
+
+inline std::size_t planned_size(const UpdatePlan& plan, const TextUpdate& update, bool utf8,
+								const CompressedValues& compressed) {
+	std::size_t size = 0;
+	for (auto& piece : plan.pieces) {
+		if (piece.kv == UpdatePlan::npos) {
+			size += piece.end - piece.begin;
+		} else if (piece.kv < compressed.size() && compressed[piece.kv]) {
+			size += text_chunk_size(update.set[piece.kv].first, *compressed[piece.kv], utf8, true);
 		} else {
-			skip_content(ifs, length);
+			size += text_chunk_size(update.set[piece.kv].first, update.set[piece.kv].second, utf8);
+		}
+	}
+	return size;
+}
+
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+T* write_planned(T* out, const unsigned char* data, const UpdatePlan& plan,
+				 const TextUpdate& update, bool utf8, const CompressedValues& compressed) {
+	for (auto& piece : plan.pieces) {
+		if (piece.kv == UpdatePlan::npos) {
+			out = std::copy(data + piece.begin, data + piece.end, out);
+		} else if (piece.kv < compressed.size() && compressed[piece.kv]) {
+			out = write_text_chunk(out, update.set[piece.kv].first, *compressed[piece.kv], utf8,
+								   true);
+		} else {
+			out = write_text_chunk(out, update.set[piece.kv].first, update.set[piece.kv].second,
+								   utf8);
 		}
 	}
+	return out;
+}
+
+// Applies `update` with one walk over the chunk headers and one write into a buffer sized up
+// front. Set entries that replace no existing chunk are inserted after IHDR.
+template <typename T = char, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::vector<T> update_text_chunks(const unsigned char* data, std::size_t size,
+								  const TextUpdate& update, bool utf8 = false,
+								  bool validity_check = true, const Compression& compression = {}) {
+	if (validity_check && !is_valid_png(data, size)) {
+		throw std::runtime_error("png signature not found");
+	}
+
+	auto plan = plan_text_update(data, size, 8, update);
+	if (std::find(plan.placed.begin(), plan.placed.end(), false) != plan.placed.end()) {
+		if (plan.insert_at == UpdatePlan::npos) {
+			throw std::runtime_error("IHDR cannot be found");
+		}
+		plan.add_unplaced(plan.insert_at);
+	}
+	auto compressed = compress_values(update.set, compression);
+	std::vector<T> ret(planned_size(plan, update, utf8, compressed));
+	write_planned(ret.data(), data, plan, update, utf8, compressed);
 	return ret;
 }
 
+template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::vector<T> update_text_chunks(const std::vector<T>& img, const TextUpdate& update,
+								  bool utf8 = false, bool validity_check = true,
+								  const Compression& compression = {}) {
+	return update_text_chunks<T>(reinterpret_cast<const unsigned char*>(img.data()), img.size(),
+								 update, utf8, validity_check, compression);
+}
+
 template <typename T = char, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
-std::unordered_map<std::string, std::string> extract_text_chunks(const std::vector<T>& img,
-																 bool validity_check = true) {
-	if (validity_check && !is_valid_png<T>(img)) {
+std::vector<T> update_text_chunks(const std::string& filename, const TextUpdate& update,
+								  bool utf8 = false, bool validity_check = true,
+								  const Compression& compression = {}) {
+	MappedFile file(filename);
+	file.will_need();
+	return update_text_chunks<T>(file.data(), file.size(), update, utf8, validity_check,
+								 compression);
+}
+
+// Reads the data and CRC of a chunk whose length and type were just consumed from `ifs` into
+// `buffer`, which is reused across calls, and returns a view of it.
+inline ChunkView read_chunk(std::ifstream& ifs, const std::string& name, std::uint32_t length,
+							std::vector<unsigned char>& buffer, std::uint64_t offset = 0) {
+	PNG_TEXT_CHUNK_STAT(allocations, buffer.capacity() < 4 + length + 4ull);
+	buffer.resize(4 + length + 4);
+	std::copy(name.begin(), name.end(), buffer.begin());
+	ifs.read(reinterpret_cast<char*>(buffer.data()) + 4, length + 4);
+	PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+	PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
+	if (!ifs) {
+		throw std::runtime_error("chunk is truncated at offset " + std::to_string(offset));
+	}
+	return {swap_endian(buffer.data()), buffer.data() + 4, length,
+			swap_endian(buffer.data() + 4 + length), static_cast<std::size_t>(offset)};
+}
+
+enum class ExtractMode {
+	full,			  // walk every chunk until IEND
+	stop_at_idat,	  // only text chunks placed before the image data
+	header_and_tail,  // text chunks before IDAT plus those found in a bounded tail region
+};
+
+// Picks up complete text chunks inside [data, data + size) without walking the chunk list,
+// e.g. the tail of a file after the image data. Candidates are located by their type and
+// accepted only if their CRC matches.
+inline void scan_text_chunks(const unsigned char* data, std::size_t size,
+							 std::unordered_map<std::string, std::string>& ret,
+							 std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	std::size_t i = 4;
+	while (i + 8 <= size) {
+		std::uint32_t type = swap_endian(data + i);
+		std::uint32_t length = swap_endian(data + i - 4);
+		if (length <= size - i - 8) {
+			ChunkView chunk{type, data + i + 4, length, swap_endian(data + i + 4 + length), i - 4};
+			if (chunk.is_text() && chunk.crc_ok()) {
+				auto [key, value] = decode_text_chunk(chunk, max_text_size);
+				ret[std::move(key)] = std::move(value);
+				i += length + 12;
+				continue;
+			}
+		}
+		i++;
+	}
+}
+
+inline std::unordered_map<std::string, std::string> extract_text_chunks(
+	const unsigned char* data, std::size_t size, ExtractMode mode,
+	std::size_t tail_size = 64 * 1024, bool validity_check = true,
+	std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	PNG_TEXT_CHUNK_STAGE(scan);
+	if (validity_check && !is_valid_png(data, size)) {
 		throw std::runtime_error("png signature not found");
-	};
+	}
 
 	std::unordered_map<std::string, std::string> ret;
+	for (auto& chunk : ChunkRange(data, size)) {
+		if (chunk.is_text()) {
+			check_crc(chunk);
+			auto [key, value] = decode_text_chunk(chunk, max_text_size);
+			ret[std::move(key)] = std::move(value);
+		} else if (chunk.type == tag::IDAT && mode != ExtractMode::full) {
+			if (mode == ExtractMode::header_and_tail) {
+				auto tail = std::max(chunk.offset, size - std::min(size, tail_size));
+				scan_text_chunks(data + tail, size - tail, ret, max_text_size);
+			}
+			break;
+		} else if (chunk.type == tag::IEND) {
+			break;
+		}
+	}
+	return ret;
+}
+
+// Reads chunk by chunk up to the first IDAT, then at most `tail_size` bytes from the end of
+// the file, so large images are never read in full. A chunk extending past the end of the
+// file throws, as in full mode.
+inline std::unordered_map<std::string, std::string> extract_text_chunks(
+	const std::string& filename, ExtractMode mode, std::size_t tail_size = 64 * 1024,
+	bool validity_check = true, std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE) {
+	if (mode == ExtractMode::full) {
+		return extract_text_chunks(filename, validity_check, false, max_text_size);
+	}
+
+	PNG_TEXT_CHUNK_STAGE(scan);
+	std::ifstream ifs;
+	ifs.open(filename, std::ios::in | std::ios::binary);
+	if (ifs.fail()) {
+		throw std::runtime_error("cannot open a file");
+	}
+	if (validity_check && !is_valid_png(ifs)) {
+		throw std::runtime_error("png signature not found");
+	}
 
-	auto begin = img.cbegin() + 8;
-	while (begin != img.end()) {
-		auto [name, length] = read_chunk_name_size<T>(begin);
-		// std::cout << "chunk: " << name << ", len: " << length << std::endl;
-		if (name == "tEXt" || name == "iTXt") {
-			auto [key, value] = read_text_chunk<T>(begin, length);
-			// std::cout << " - key: " << key << ", value: " << value << std::endl;
+	std::unordered_map<std::string, std::string> ret;
+	std::vector<unsigned char> content;
+	ifs.seekg(0, std::ios::end);
+	std::uint64_t file_size = ifs.tellg();
+	std::uint64_t offset = 8;
+	ifs.seekg(offset);
+	while (offset < file_size) {
+		auto [name, length] = read_chunk_name_size(ifs);
+		if (!ifs || file_size - offset < length + 12ull) {
+			throw to_exception({Errc::truncated_chunk, offset});
+		}
+		if (name == "tEXt" || name == "iTXt" || name == "zTXt") {
+			auto chunk = read_chunk(ifs, name, length, content, offset);
+			check_crc(chunk);
+			auto [key, value] = decode_text_chunk(chunk, max_text_size);
 			ret[std::move(key)] = std::move(value);
+		} else if (name == "IDAT") {
+			if (mode == ExtractMode::header_and_tail) {
+				auto tail = std::max<std::uint64_t>(offset, file_size - std::min<std::uint64_t>(
+																		 file_size, tail_size));
+				std::vector<unsigned char> buffer(file_size - tail);
+				PNG_TEXT_CHUNK_STAT(allocations, 1);
+				ifs.seekg(tail);
+				ifs.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+				PNG_TEXT_CHUNK_STAT(stream_reads, 1);
+				PNG_TEXT_CHUNK_STAT(bytes_read, ifs.gcount());
+				scan_text_chunks(buffer.data(), static_cast<std::size_t>(ifs.gcount()), ret,
+								 max_text_size);
+			}
+			break;
 		} else if (name == "IEND") {
 			break;
 		} else {
-			skip_content<T>(begin, length);
+			skip_content(ifs, length);
 		}
+		offset += length + 12ull;
 	}
+	return ret;
+}
 
+struct TextView {
+	std::string_view key;
+	std::string_view value;
+	std::size_t offset;	 // offset of the chunk's length field
+	std::uint32_t type;	 // tag::tEXt/zTXt (Latin-1) or tag::iTXt (UTF-8)
+	bool compressed;	 // value is a zlib stream, see inflate_text()
+};
+
+// Text chunks in file order, referencing the source buffer; valid while the buffer lives.
+// Compressed texts are returned as-is.
+inline std::vector<TextView> extract_text_chunk_views(const void* data, std::size_t size,
+													  bool validity_check = true,
+													  bool verify_crc = true) {
+	if (validity_check && !is_valid_png(static_cast<const unsigned char*>(data), size)) {
+		throw std::runtime_error("png signature not found");
+	}
+	PNG_TEXT_CHUNK_STAGE(scan);
+	std::vector<TextView> ret;
+	for (auto& chunk : ChunkRange(data, size)) {
+		if (chunk.is_text()) {
+			if (verify_crc) {
+				check_crc(chunk);
+			}
+			auto fields = parse_text_fields(chunk);
+			PNG_TEXT_CHUNK_STAT(allocations, ret.size() == ret.capacity());
+			ret.push_back({fields.key, fields.text, chunk.offset, chunk.type, fields.compressed});
+		} else if (chunk.type == tag::IEND) {
+			break;
+		}
+	}
 	return ret;
 }
+
+template <typename T = char, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+std::vector<TextView> extract_text_chunk_views(const std::vector<T>& img,
+											   bool validity_check = true, bool verify_crc = true) {
+	return extract_text_chunk_views(img.data(), img.size(), validity_check, verify_crc);
+}
 }  // namespace png_text_chunk
\ No newline at end of file
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Define PNG_TEXT_CHUNK_STATS to count the work done by extraction and insertion. Without it
+// the counting macros expand to nothing and their arguments are never evaluated.
+namespace png_text_chunk {
+#ifdef PNG_TEXT_CHUNK_STATS
+constexpr bool stats_enabled = true;
+#else
+constexpr bool stats_enabled = false;
+#endif
+
+struct ChunkCounts {
+	std::uint64_t IHDR = 0;
+	std::uint64_t IDAT = 0;
+	std::uint64_t IEND = 0;
+	std::uint64_t tEXt = 0;
+	std::uint64_t zTXt = 0;
+	std::uint64_t iTXt = 0;
+	std::uint64_t other = 0;
+
+	std::uint64_t& of(std::uint32_t type) {
+		auto is = [type](const char (&name)[5]) {
+			return type == (std::uint32_t(std::uint8_t(name[0])) << 24 |
+							std::uint32_t(std::uint8_t(name[1])) << 16 |
+							std::uint32_t(std::uint8_t(name[2])) << 8 | std::uint8_t(name[3]));
+		};
+		return is("IDAT")	? IDAT
+			   : is("tEXt") ? tEXt
+			   : is("zTXt") ? zTXt
+			   : is("iTXt") ? iTXt
+			   : is("IHDR") ? IHDR
+			   : is("IEND") ? IEND
+							: other;
+	}
+
+	std::uint64_t total() const { return IHDR + IDAT + IEND + tEXt + zTXt + iTXt + other; }
+};
+
+enum class Stage { none, scan, crc, decode, write };
+
+// Counters of the calling thread. Stage times are exclusive: the CRC of a chunk checked
+// during a scan is charged to crc_ns only, so the stages add up to the time spent in them.
+struct Stats {
+	std::uint64_t bytes_read = 0;	 // read from files, or mapped
+	// issued directly on file descriptors: open, mmap, read, pread, write, copy_file_range, ...
+	std::uint64_t syscalls = 0;
+	// reads from a std::ifstream; the stream buffers them into fewer, uncounted syscalls
+	std::uint64_t stream_reads = 0;
+	ChunkCounts chunks;				 // chunk headers parsed
+	std::uint64_t crc_bytes = 0;	 // bytes hashed by calculate_crc
+	std::uint64_t bytes_copied = 0;	 // image bytes moved in memory or between files
+	std::uint64_t allocations = 0;	 // buffers and result strings the library allocated
+	std::uint64_t scan_ns = 0;
+	std::uint64_t crc_ns = 0;
+	std::uint64_t decode_ns = 0;
+	std::uint64_t write_ns = 0;
+
+	std::uint64_t& stage_ns(Stage stage) {
+		return stage == Stage::scan ? scan_ns : stage == Stage::crc ? crc_ns
+											: stage == Stage::decode ? decode_ns
+																	 : write_ns;
+	}
+
+	Stats& operator+=(const Stats& other) {
+		bytes_read += other.bytes_read;
+		syscalls += other.syscalls;
+		stream_reads += other.stream_reads;
+		chunks.IHDR += other.chunks.IHDR;
+		chunks.IDAT += other.chunks.IDAT;
+		chunks.IEND += other.chunks.IEND;
+		chunks.tEXt += other.chunks.tEXt;
+		chunks.zTXt += other.chunks.zTXt;
+		chunks.iTXt += other.chunks.iTXt;
+		chunks.other += other.chunks.other;
+		crc_bytes += other.crc_bytes;
+		bytes_copied += other.bytes_copied;
+		allocations += other.allocations;
+		scan_ns += other.scan_ns;
+		crc_ns += other.crc_ns;
+		decode_ns += other.decode_ns;
+		write_ns += other.write_ns;
+		return *this;
+	}
+};
+
+namespace stats_detail {
+struct ThreadState {
+	Stats stats;
+	Stage stage = Stage::none;
+	std::chrono::steady_clock::time_point since;
+};
+
+inline ThreadState& state() {
+	thread_local ThreadState s;
+	return s;
+}
+
+// charges the time since the last switch to the running stage
+inline Stage switch_stage(Stage stage) {
+	auto& s = state();
+	auto now = std::chrono::steady_clock::now();
+	if (s.stage != Stage::none) {
+		s.stats.stage_ns(s.stage) += static_cast<std::uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(now - s.since).count());
+	}
+	auto previous = s.stage;
+	s.stage = stage;
+	s.since = now;
+	return previous;
+}
+
+// a string owns a heap buffer once it outgrows the small-string buffer
+template <class String>
+std::uint64_t heap_strings(const String& a, const String& b) {
+	static const auto inline_capacity = String().capacity();
+	return (a.capacity() > inline_capacity) + (b.capacity() > inline_capacity);
+}
+}  // namespace stats_detail
+
+// Counters accumulated on this thread since it started or since the last reset. Work that
+// a thread pool runs is counted on the pool's threads. Always zero without
+// PNG_TEXT_CHUNK_STATS.
+inline const Stats& thread_stats() { return stats_detail::state().stats; }
+
+// Returns the counters of this thread and zeroes them, e.g. around one call.
+inline Stats take_thread_stats() {
+	auto& s = stats_detail::state();
+	Stats ret = s.stats;
+	s.stats = {};
+	return ret;
+}
+
+// Attributes the time until the end of the scope to `stage`, then resumes the enclosing one.
+class StageTimer {
+   public:
+	explicit StageTimer(Stage stage) : previous_(stats_detail::switch_stage(stage)) {}
+	~StageTimer() { stats_detail::switch_stage(previous_); }
+	StageTimer(const StageTimer&) = delete;
+	StageTimer& operator=(const StageTimer&) = delete;
+
+   private:
+	Stage previous_;
+};
+}  // namespace png_text_chunk
+
+#ifdef PNG_TEXT_CHUNK_STATS
+#define PNG_TEXT_CHUNK_STAT(field, n) \
+	(void)(::png_text_chunk::stats_detail::state().stats.field += (n))
+#define PNG_TEXT_CHUNK_STAGE(stage) \
+	::png_text_chunk::StageTimer png_text_chunk_stage_timer_(::png_text_chunk::Stage::stage)
+#else
+#define PNG_TEXT_CHUNK_STAT(field, n) ((void)0)
+#define PNG_TEXT_CHUNK_STAGE(stage) ((void)0)
+#endif
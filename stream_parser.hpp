@@ -0,0 +1,163 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "png_text_chunk.hpp"
+
+namespace png_text_chunk {
+// Push parser for PNGs that arrive in pieces. feed() accepts the stream in arbitrary slices
+// and calls `on_text` as soon as a text chunk and its CRC are complete. Only text chunks are
+// buffered; other chunk data is checked with a running CRC and dropped.
+class TextChunkParser {
+   public:
+	using Callback = std::function<void(std::string key, std::string value)>;
+
+	explicit TextChunkParser(Callback on_text, bool verify_crc = true,
+							 std::size_t max_text_size = DEFAULT_MAX_TEXT_SIZE)
+		: on_text_(std::move(on_text)), verify_crc_(verify_crc), max_text_size_(max_text_size) {}
+
+	// true once IEND has been parsed; bytes fed afterwards are ignored. A stream that ends
+	// before this is truncated.
+	bool done() const { return state_ == State::done; }
+
+	// number of stream bytes consumed so far
+	std::uint64_t offset() const { return offset_; }
+
+	// Throws on a bad signature, a CRC mismatch or a malformed text chunk.
+	void feed(const void* data, std::size_t size) {
+		auto p = static_cast<const unsigned char*>(data);
+		while (size > 0 && state_ != State::done) {
+			std::size_t n = 0;
+			switch (state_) {
+				case State::signature:
+					n = fill(p, size, 8);
+					if (filled_ == 8) {
+						if (!is_valid_png(small_.data(), 8)) {
+							throw std::runtime_error("png signature not found");
+						}
+						start_header();
+					}
+					break;
+				case State::header:
+					n = fill(p, size, 8);
+					if (filled_ == 8) {
+						start_data();
+					}
+					break;
+				case State::data:
+					n = static_cast<std::size_t>(std::min<std::uint64_t>(size, remaining_));
+					if (is_text_) {
+						std::memcpy(text_.data() + text_.size() - remaining_, p, n);
+					} else if (verify_crc_) {
+						crc_ = calculate_crc(p, n, crc_);
+					}
+					remaining_ -= n;
+					if (remaining_ == 0) {
+						start_crc();
+					}
+					break;
+				case State::crc:
+					n = fill(p, size, 4);
+					if (filled_ == 4) {
+						finish_chunk();
+					}
+					break;
+				case State::done:
+					break;
+			}
+			p += n;
+			size -= n;
+			offset_ += n;
+		}
+	}
+
+	template <typename T, std::enable_if_t<is_char_v<T>, std::nullptr_t> = nullptr>
+	void feed(const std::vector<T>& bytes) {
+		feed(bytes.data(), bytes.size());
+	}
+
+   private:
+	enum class State { signature, header, data, crc, done };
+
+	std::size_t fill(const unsigned char* p, std::size_t size, std::size_t want) {
+		auto n = std::min(size, want - filled_);
+		std::memcpy(small_.data() + filled_, p, n);
+		filled_ += n;
+		return n;
+	}
+
+	void start_header() {
+		state_ = State::header;
+		filled_ = 0;
+	}
+
+	void start_data() {
+		length_ = swap_endian(small_.data());
+		type_ = swap_endian(small_.data() + 4);
+		std::memcpy(name_.data(), small_.data() + 4, 4);
+		is_text_ = type_ == tag::tEXt || type_ == tag::iTXt || type_ == tag::zTXt;
+		if (is_text_) {
+			if (length_ > max_text_size_) {
+				throw std::runtime_error("text chunk exceeds " + std::to_string(max_text_size_) +
+										 " bytes");
+			}
+			// type, then data, as ChunkView::crc_ok expects
+			text_.resize(4 + length_);
+			std::memcpy(text_.data(), small_.data() + 4, 4);
+		} else if (verify_crc_) {
+			crc_ = calculate_crc(small_.data() + 4, 4);
+		}
+		remaining_ = length_;
+		state_ = State::data;
+		if (remaining_ == 0) {
+			start_crc();
+		}
+	}
+
+	void start_crc() {
+		state_ = State::crc;
+		filled_ = 0;
+	}
+
+	void finish_chunk() {
+		std::uint32_t stored = swap_endian(small_.data());
+		if (is_text_) {
+			ChunkView chunk{type_, text_.data() + 4, length_, stored, chunk_offset_};
+			if (verify_crc_) {
+				check_crc(chunk);
+			}
+			auto [key, value] = decode_text_chunk(chunk, max_text_size_);
+			on_text_(std::move(key), std::move(value));
+		} else if (verify_crc_ && crc_ != stored) {
+			throw crc_error({std::string(name_.data(), 4), chunk_offset_});
+		}
+		if (type_ == tag::IEND) {
+			state_ = State::done;
+			return;
+		}
+		chunk_offset_ += 12ull + length_;
+		start_header();
+	}
+
+	Callback on_text_;
+	bool verify_crc_;
+	std::size_t max_text_size_;
+
+	State state_ = State::signature;
+	std::array<unsigned char, 8> small_{};	// signature, chunk header or CRC being assembled
+	std::size_t filled_ = 0;
+	std::uint64_t offset_ = 0;
+	std::size_t chunk_offset_ = 8;
+	std::uint32_t length_ = 0;
+	std::uint32_t type_ = 0;
+	std::array<char, 4> name_{};
+	std::uint64_t remaining_ = 0;
+	bool is_text_ = false;
+	std::uint32_t crc_ = 0;
+	std::vector<unsigned char> text_;
+};
+}  // namespace png_text_chunk
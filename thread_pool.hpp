@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace png_text_chunk {
+// Work-stealing thread pool. Each worker owns a deque: tasks submitted from a worker go to
+// its own deque and are popped LIFO, idle workers steal FIFO from the others.
+class ThreadPool {
+   public:
+	static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+	explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency()) {
+		if (threads == 0) {
+			threads = 1;
+		}
+		for (std::size_t i = 0; i < threads; i++) {
+			queues_.push_back(std::make_unique<Queue>());
+		}
+		for (std::size_t i = 0; i < threads; i++) {
+			threads_.emplace_back([this, i] { run(i); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		cv_.notify_all();
+		for (auto& thread : threads_) {
+			thread.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	std::size_t size() const { return threads_.size(); }
+
+	// index of the calling worker in [0, size()), or npos outside of any pool
+	static std::size_t current_worker() { return worker_index(); }
+
+	void submit(std::function<void()> task) {
+		auto index = (worker_pool() == this) ? worker_index() : next_++ % queues_.size();
+		{
+			std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+			queues_[index]->tasks.push_back(std::move(task));
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			queued_++;
+		}
+		cv_.notify_one();
+	}
+
+	// Blocks until every submitted task has finished, then rethrows the first exception
+	// thrown by a task, if any.
+	void wait() {
+		std::unique_lock<std::mutex> lock(mutex_);
+		done_cv_.wait(lock, [this] { return queued_ == 0 && active_ == 0; });
+		if (error_) {
+			auto error = error_;
+			error_ = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+
+   private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	static std::size_t& worker_index() {
+		thread_local std::size_t index = npos;
+		return index;
+	}
+
+	static const ThreadPool*& worker_pool() {
+		thread_local const ThreadPool* pool = nullptr;
+		return pool;
+	}
+
+	bool try_pop(std::size_t self, std::function<void()>& task) {
+		{
+			auto& own = *queues_[self];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.tasks.empty()) {
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				return true;
+			}
+		}
+		for (std::size_t i = 1; i < queues_.size(); i++) {
+			auto& victim = *queues_[(self + i) % queues_.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty()) {
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void run(std::size_t self) {
+		worker_index() = self;
+		worker_pool() = this;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				cv_.wait(lock, [this] { return stop_ || queued_ > 0; });
+				if (queued_ == 0) {
+					return;
+				}
+				// reserves one task, which is already in some deque
+				queued_--;
+				active_++;
+			}
+			std::function<void()> task;
+			while (!try_pop(self, task)) {
+				std::this_thread::yield();
+			}
+			try {
+				task();
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (!error_) {
+					error_ = std::current_exception();
+				}
+			}
+			std::lock_guard<std::mutex> lock(mutex_);
+			active_--;
+			if (queued_ == 0 && active_ == 0) {
+				done_cv_.notify_all();
+			}
+		}
+	}
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::vector<std::thread> threads_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::condition_variable done_cv_;
+	std::size_t queued_ = 0;
+	std::size_t active_ = 0;
+	std::atomic<std::size_t> next_{0};
+	bool stop_ = false;
+	std::exception_ptr error_;
+};
+}  // namespace png_text_chunk
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "error.hpp"
+#include "stats.hpp"
+
+// Define PNG_TEXT_CHUNK_USE_ZLIB and link zlib to read and write zTXt and compressed iTXt.
+#ifdef PNG_TEXT_CHUNK_USE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace png_text_chunk {
+// upper bound on the size of one decompressed text, against zip bombs
+constexpr std::size_t DEFAULT_MAX_TEXT_SIZE = 64 * 1024 * 1024;
+
+#ifdef PNG_TEXT_CHUNK_USE_ZLIB
+namespace zlib_detail {
+// zlib allocation hooks over the std::pmr::memory_resource in `opaque`. Each block starts with
+// its size, which deallocate needs and zfree does not pass.
+constexpr std::size_t block_header = alignof(std::max_align_t);
+
+inline voidpf resource_alloc(voidpf opaque, uInt items, uInt size) {
+	auto bytes = block_header + std::size_t(items) * size;
+	try {
+		auto block = static_cast<unsigned char*>(static_cast<std::pmr::memory_resource*>(opaque)
+													 ->allocate(bytes, alignof(std::max_align_t)));
+		std::memcpy(block, &bytes, sizeof(bytes));
+		return block + block_header;
+	} catch (const std::bad_alloc&) {
+		return Z_NULL;
+	}
+}
+
+inline void resource_free(voidpf opaque, voidpf address) {
+	auto block = static_cast<unsigned char*>(address) - block_header;
+	std::size_t bytes;
+	std::memcpy(&bytes, block, sizeof(bytes));
+	static_cast<std::pmr::memory_resource*>(opaque)->deallocate(block, bytes,
+																alignof(std::max_align_t));
+}
+
+struct Inflater {
+	z_stream zs{};
+	// zlib allocates its state and window with malloc unless `resource` is given
+	explicit Inflater(std::pmr::memory_resource* resource = nullptr) {
+		if (resource) {
+			zs.zalloc = resource_alloc;
+			zs.zfree = resource_free;
+			zs.opaque = resource;
+		}
+		if (inflateInit(&zs) != Z_OK) {
+			throw std::runtime_error("inflateInit failed");
+		}
+	}
+	~Inflater() { inflateEnd(&zs); }
+	Inflater(const Inflater&) = delete;
+	Inflater& operator=(const Inflater&) = delete;
+};
+
+struct Deflater {
+	z_stream zs{};
+	explicit Deflater(int level) {
+		if (deflateInit(&zs, level) != Z_OK) {
+			throw std::runtime_error("deflateInit failed");
+		}
+	}
+	~Deflater() { deflateEnd(&zs); }
+	Deflater(const Deflater&) = delete;
+	Deflater& operator=(const Deflater&) = delete;
+};
+}  // namespace zlib_detail
+#endif
+
+// Inflates a zlib stream directly into `out`, growing it geometrically and stopping as soon
+// as the output would exceed `max_size` bytes. Malformed input is reported, not thrown.
+// `String` is std::string or std::pmr::string; for the latter zlib's inflate state and window
+// are also allocated from the string's memory_resource.
+template <class String>
+Errc try_inflate_text(std::string_view compressed, std::size_t max_size, String& out) {
+#ifdef PNG_TEXT_CHUNK_USE_ZLIB
+	PNG_TEXT_CHUNK_STAGE(decode);
+	std::pmr::memory_resource* resource = nullptr;
+	if constexpr (std::is_same_v<String, std::pmr::string>) {
+		resource = out.get_allocator().resource();
+	}
+	zlib_detail::Inflater inflater(resource);
+	auto& zs = inflater.zs;
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+	zs.avail_in = static_cast<uInt>(std::min<std::size_t>(compressed.size(), UINT_MAX));
+
+	// one byte of headroom tells "exactly max_size" apart from "more than max_size"
+	std::size_t limit = max_size == static_cast<std::size_t>(-1) ? max_size : max_size + 1;
+	out.assign(std::min(limit, std::max<std::size_t>(compressed.size() * 4, 256)), '\0');
+	PNG_TEXT_CHUNK_STAT(allocations, 1);
+	std::size_t produced = 0;
+	while (true) {
+		if (produced == out.size()) {
+			if (out.size() >= limit) {
+				return Errc::text_too_large;
+			}
+			out.resize(std::min(limit, out.size() * 2));
+			PNG_TEXT_CHUNK_STAT(allocations, 1);
+		}
+		auto avail_out = static_cast<uInt>(std::min<std::size_t>(out.size() - produced, UINT_MAX));
+		zs.next_out = reinterpret_cast<Bytef*>(&out[produced]);
+		zs.avail_out = avail_out;
+		int ret = inflate(&zs, Z_NO_FLUSH);
+		produced += avail_out - zs.avail_out;
+		if (ret == Z_STREAM_END) {
+			break;
+		}
+		if (ret == Z_BUF_ERROR && zs.avail_out > 0) {
+			return Errc::compressed_text_truncated;
+		}
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			return Errc::compressed_text_broken;
+		}
+	}
+	if (produced > max_size) {
+		return Errc::text_too_large;
+	}
+	out.resize(produced);
+	return Errc::ok;
+#else
+	(void)compressed, (void)max_size, (void)out;
+	return Errc::compression_unsupported;
+#endif
+}
+
+inline std::string inflate_text(std::string_view compressed,
+								std::size_t max_size = DEFAULT_MAX_TEXT_SIZE) {
+	std::string out;
+	auto code = try_inflate_text(compressed, max_size, out);
+	if (code == Errc::text_too_large) {
+		throw std::runtime_error("decompressed text exceeds " + std::to_string(max_size) +
+								 " bytes");
+	}
+	if (code != Errc::ok) {
+		throw std::runtime_error(error_message(code));
+	}
+	return out;
+}
+
+// Compresses `text` into a zlib stream as stored in zTXt and compressed iTXt.
+inline std::string deflate_text(std::string_view text, int level = 6) {
+	if (level < 1 || level > 9) {
+		throw std::runtime_error("compression level must be within 1~9");
+	}
+#ifdef PNG_TEXT_CHUNK_USE_ZLIB
+	if (text.size() > UINT_MAX) {
+		throw std::runtime_error("text is too large to compress");
+	}
+	zlib_detail::Deflater deflater(level);
+	auto& zs = deflater.zs;
+	std::string out(deflateBound(&zs, static_cast<uLong>(text.size())), '\0');
+	zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(text.data()));
+	zs.avail_in = static_cast<uInt>(text.size());
+	zs.next_out = reinterpret_cast<Bytef*>(&out[0]);
+	zs.avail_out = static_cast<uInt>(out.size());
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		throw std::runtime_error("deflate failed");
+	}
+	out.resize(zs.total_out);
+	return out;
+#else
+	(void)text;
+	throw std::runtime_error("compressed text is not supported: built without zlib");
+#endif
+}
+}  // namespace png_text_chunk